@@ -0,0 +1,210 @@
+#include "dirty-tracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+  // Soft-dirty flag of a pagemap entry, see Documentation/admin-guide/mm/soft-dirty.rst
+  constexpr uint64_t PagemapSoftDirty = 1ull << 55;
+
+  // Shared with the signal handler, which may only touch preallocated memory
+  struct ProtectState {
+    std::atomic<uintptr_t> begin { 0 };
+    std::atomic<uintptr_t> end { 0 };
+    size_t page_size;
+    uint32_t* dirty;
+    size_t capacity;
+    std::atomic<size_t> count { 0 };
+    struct sigaction previous;
+    bool installed { false };
+  } protect_state;
+
+  void OnSegv(int sig, siginfo_t* info, void* context) {
+    auto& state = protect_state;
+    auto addr = (uintptr_t)info->si_addr;
+    auto begin = state.begin.load(std::memory_order_relaxed);
+    if(addr >= begin && addr < state.end.load(std::memory_order_relaxed)) {
+      // A page is unprotected on its first write, so it faults only once
+      size_t page = (addr - begin) / state.page_size;
+      size_t n = state.count.load(std::memory_order_relaxed);
+      if(n < state.capacity &&
+         mprotect((void*)(begin + page * state.page_size), state.page_size, PROT_READ | PROT_WRITE) == 0) {
+        state.dirty[n] = page;
+        state.count.store(n + 1, std::memory_order_relaxed);
+        return;
+      }
+    }
+
+    // Not ours, e.g. an out of bounds access caught by the trap handler of the engine
+    auto& previous = state.previous;
+    if(previous.sa_flags & SA_SIGINFO) {
+      previous.sa_sigaction(sig, info, context);
+    } else if(previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN) {
+      // The access faults again when the handler returns and takes the default action
+      signal(sig, SIG_DFL);
+    } else {
+      previous.sa_handler(sig);
+    }
+  }
+
+  bool InstallHandler() {
+    if(protect_state.installed)
+      return true;
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = OnSegv;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    if(sigaction(SIGSEGV, &action, &protect_state.previous) != 0)
+      return false;
+    protect_state.installed = true;
+    return true;
+  }
+}
+
+// Without CONFIG_MEM_SOFT_DIRTY the bits read as zero, which would hide every
+// write, so check that a written page shows up as soft-dirty
+bool dfw::DirtyTracker::ProbeSoftDirty() {
+  void* page = mmap(nullptr, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(page == MAP_FAILED)
+    return false;
+
+  uint64_t entry = 0;
+  bool ok = pwrite(clear_refs_fd, "4", 1, 0) == 1;
+  *(uint8_t volatile*)page = 1;
+  ok = ok && pread(pagemap_fd, &entry, sizeof(entry), (uintptr_t)page / page_size * sizeof(entry)) == sizeof(entry);
+  munmap(page, page_size);
+  return ok && (entry & PagemapSoftDirty) != 0;
+}
+
+std::optional<dfw::DirtyTracking> dfw::ParseDirtyTracking(char const* name) {
+  if(std::strcmp(name, "off") == 0)
+    return DirtyTracking::Off;
+  else if(std::strcmp(name, "protect") == 0)
+    return DirtyTracking::Protect;
+  else if(std::strcmp(name, "soft-dirty") == 0)
+    return DirtyTracking::SoftDirty;
+  return std::nullopt;
+}
+
+dfw::DirtyTracker::DirtyTracker(DirtyTracking mode) : mode(mode), page_size(sysconf(_SC_PAGESIZE)) {
+  if(mode == DirtyTracking::SoftDirty) {
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if(pagemap_fd >= 0 && clear_refs_fd >= 0 && !ProbeSoftDirty()) {
+      close(pagemap_fd);
+      close(clear_refs_fd);
+      pagemap_fd = clear_refs_fd = -1;
+    }
+  }
+}
+
+dfw::DirtyTracker::~DirtyTracker() {
+  std::vector<std::pair<size_t, size_t>> spans;
+  Collect(spans); // Unprotect the memory if still armed
+  if(pagemap_fd >= 0) close(pagemap_fd);
+  if(clear_refs_fd >= 0) close(clear_refs_fd);
+}
+
+bool dfw::DirtyTracker::Arm(uint8_t* memory, size_t length) {
+  if(mode == DirtyTracking::Off || memory == nullptr || length == 0)
+    return false;
+
+  // Only the pages entirely inside of the memory are tracked, the pages next
+  // to it may be guard pages of the engine
+  this->memory = memory;
+  this->length = length;
+  region_begin = ((uintptr_t)memory + page_size - 1) & ~(uintptr_t)(page_size - 1);
+  uintptr_t region_end = ((uintptr_t)memory + length) & ~(uintptr_t)(page_size - 1);
+  if(region_end <= region_begin)
+    return false;
+  size_t region_pages = (region_end - region_begin) / page_size;
+
+  if(mode == DirtyTracking::SoftDirty) {
+    if(pagemap_fd < 0 || clear_refs_fd < 0)
+      return false;
+    // Clears the soft-dirty bits of the whole process
+    if(pwrite(clear_refs_fd, "4", 1, 0) != 1)
+      return false;
+    this->region_pages = region_pages;
+    return true;
+  }
+
+  if(protect_state.end.load() != 0 || !InstallHandler())
+    return false;
+
+  // Allocated before the handler can run
+  dirty.resize(region_pages);
+  protect_state.page_size = page_size;
+  protect_state.dirty = dirty.data();
+  protect_state.capacity = dirty.size();
+  protect_state.count.store(0);
+  protect_state.begin.store(region_begin);
+  protect_state.end.store(region_begin + region_pages * page_size);
+
+  if(mprotect((void*)region_begin, region_pages * page_size, PROT_READ) != 0) {
+    protect_state.end.store(0);
+    protect_state.begin.store(0);
+    return false;
+  }
+  this->region_pages = region_pages;
+  return true;
+}
+
+void dfw::DirtyTracker::AddSpan(std::vector<std::pair<size_t, size_t>>& spans, size_t begin, size_t end) {
+  if(begin >= end)
+    return;
+  if(!spans.empty() && spans.back().second == begin)
+    spans.back().second = end;
+  else
+    spans.emplace_back(begin, end);
+}
+
+void dfw::DirtyTracker::AddPage(std::vector<std::pair<size_t, size_t>>& spans, size_t page) {
+  size_t begin = region_begin + page * page_size - (uintptr_t)memory;
+  AddSpan(spans, begin, begin + page_size);
+}
+
+bool dfw::DirtyTracker::CollectProtected(std::vector<std::pair<size_t, size_t>>& spans) {
+  protect_state.end.store(0);
+  protect_state.begin.store(0);
+  bool restored = mprotect((void*)region_begin, region_pages * page_size, PROT_READ | PROT_WRITE) == 0;
+
+  size_t count = protect_state.count.load();
+  std::sort(dirty.begin(), dirty.begin() + count);
+  for(size_t i = 0; i < count; i++)
+    AddPage(spans, dirty[i]);
+  return restored;
+}
+
+bool dfw::DirtyTracker::CollectSoftDirty(std::vector<std::pair<size_t, size_t>>& spans) {
+  pagemap.resize(region_pages);
+  size_t size = region_pages * sizeof(uint64_t);
+  if(pread(pagemap_fd, pagemap.data(), size, region_begin / page_size * sizeof(uint64_t)) != (ssize_t)size)
+    return false;
+
+  for(size_t page = 0; page < region_pages; page++) {
+    if(pagemap[page] & PagemapSoftDirty)
+      AddPage(spans, page);
+  }
+  return true;
+}
+
+bool dfw::DirtyTracker::Collect(std::vector<std::pair<size_t, size_t>>& spans) {
+  spans.clear();
+  if(region_pages == 0)
+    return false;
+
+  // The partial pages at both ends of the memory are always compared
+  AddSpan(spans, 0, region_begin - (uintptr_t)memory);
+  bool ret = mode == DirtyTracking::Protect ? CollectProtected(spans) : CollectSoftDirty(spans);
+  AddSpan(spans, region_begin + region_pages * page_size - (uintptr_t)memory, length);
+  region_pages = 0;
+  return ret;
+}
@@ -0,0 +1,63 @@
+#ifndef DIRTY_TRACKER_H
+#define DIRTY_TRACKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace dfw {
+
+// How the runner finds the pages of the wasm memory a call wrote to
+enum class DirtyTracking {
+  Off,       // Compare the whole memory after every call
+  Protect,   // Write-protect the memory and record the pages faulting on write
+  SoftDirty  // Read the soft-dirty bits of /proc/self/pagemap
+};
+
+std::optional<DirtyTracking> ParseDirtyTracking(char const* name);
+
+// Records the pages of a memory region written between Arm and Collect. In
+// protect mode a SIGSEGV handler unprotects and records the faulting pages;
+// faults outside of the region are passed on to the previous handler, which
+// is the trap handler of the engine. Only one tracker can be armed at a time.
+class DirtyTracker {
+  DirtyTracking mode;
+  size_t page_size;
+  int pagemap_fd { -1 };
+  int clear_refs_fd { -1 };
+
+  uint8_t* memory { nullptr };
+  size_t length { 0 };
+  uintptr_t region_begin { 0 }; // memory rounded up to a page
+  size_t region_pages { 0 };
+  std::vector<uint32_t> dirty; // Pages recorded by the signal handler
+  std::vector<uint64_t> pagemap;
+
+  bool ProbeSoftDirty();
+  bool CollectProtected(std::vector<std::pair<size_t, size_t>>& spans);
+  bool CollectSoftDirty(std::vector<std::pair<size_t, size_t>>& spans);
+  void AddSpan(std::vector<std::pair<size_t, size_t>>& spans, size_t begin, size_t end);
+  void AddPage(std::vector<std::pair<size_t, size_t>>& spans, size_t page);
+
+public:
+  DirtyTracker(DirtyTracking mode);
+  DirtyTracker(DirtyTracker const&) = delete;
+  DirtyTracker& operator=(DirtyTracker const&) = delete;
+  ~DirtyTracker();
+
+  DirtyTracking Mode() const { return mode; }
+
+  // Start tracking the writes to the memory, false if it cannot be tracked,
+  // e.g. when the kernel does not support soft-dirty bits
+  bool Arm(uint8_t* memory, size_t length);
+  // Stop tracking and return the written spans [begin, end) relative to the
+  // memory, sorted and coalesced. False if the writes are unknown, the whole
+  // memory must be compared then.
+  bool Collect(std::vector<std::pair<size_t, size_t>>& spans);
+};
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "divergence.h"
+
+namespace {
+  // Values are reported in their binary representation without a type, so a
+  // value is taken as a NaN if it is one either as f64 or as a sign extended f32
+  bool IsNanF64(int64_t value) {
+    uint64_t bits = (uint64_t)value;
+    return (bits & 0x7FF0000000000000ull) == 0x7FF0000000000000ull && (bits & 0x000FFFFFFFFFFFFFull) != 0;
+  }
+
+  bool IsNanF32(int64_t value) {
+    if(value != (int64_t)(int32_t)value)
+      return false;
+    uint32_t bits = (uint32_t)value;
+    return (bits & 0x7F800000u) == 0x7F800000u && (bits & 0x007FFFFFu) != 0;
+  }
+
+  bool BothNan(int64_t a, int64_t b) {
+    return (IsNanF64(a) && IsNanF64(b)) || (IsNanF32(a) && IsNanF32(b));
+  }
+
+  enum class Compare { Same, NanPayload, Different };
+
+  Compare CompareValue(int64_t a, int64_t b) {
+    if(a == b)
+      return Compare::Same;
+    return BothNan(a, b) ? Compare::NanPayload : Compare::Different;
+  }
+
+  Compare CompareGlobals(std::vector<dfw::GlobalChange> const& a, std::vector<dfw::GlobalChange> const& b) {
+    if(a.size() != b.size())
+      return Compare::Different;
+
+    Compare ret = Compare::Same;
+    for(size_t i = 0; i < a.size(); i++) {
+      if(a[i].index != b[i].index)
+        return Compare::Different;
+      auto before = CompareValue(a[i].before, b[i].before);
+      auto after = CompareValue(a[i].after, b[i].after);
+      if(before == Compare::Different || after == Compare::Different)
+        return Compare::Different;
+      if(before == Compare::NanPayload || after == Compare::NanPayload)
+        ret = Compare::NanPayload;
+    }
+    return ret;
+  }
+}
+
+char const* dfw::DivergenceName(Divergence category) {
+  switch(category) {
+    case Divergence::ResultMismatch: return "result_mismatch";
+    case Divergence::TrapAsymmetry: return "trap_asymmetry";
+    case Divergence::MemoryDiffMismatch: return "memory_diff_mismatch";
+    case Divergence::GlobalDiffMismatch: return "global_diff_mismatch";
+    case Divergence::SignalAsymmetry: return "signal_asymmetry";
+    case Divergence::TimeoutAsymmetry: return "timeout_asymmetry";
+    case Divergence::NanPayloadOnly: return "nan_payload_only";
+    case Divergence::MemoryStateMismatch: return "memory_state_mismatch";
+    default: return "unknown";
+  }
+}
+
+std::optional<dfw::Divergence> dfw::ClassifyCall(CallRecord const& v8_exec, CallRecord const& moz_exec) {
+  if(v8_exec.success != moz_exec.success)
+    return Divergence::TrapAsymmetry;
+
+  // The most specific disagreement wins, a NaN payload only when nothing else differs
+  Compare result = Compare::Same;
+  if(v8_exec.result != moz_exec.result) {
+    if(!v8_exec.result.has_value() || !moz_exec.result.has_value())
+      return Divergence::ResultMismatch;
+    result = CompareValue(*v8_exec.result, *moz_exec.result);
+    if(result == Compare::Different)
+      return Divergence::ResultMismatch;
+  }
+
+  if(v8_exec.memory_diff != moz_exec.memory_diff)
+    return Divergence::MemoryDiffMismatch;
+
+  auto globals = CompareGlobals(v8_exec.global_diff, moz_exec.global_diff);
+  if(globals == Compare::Different)
+    return Divergence::GlobalDiffMismatch;
+
+  if(result == Compare::NanPayload || globals == Compare::NanPayload)
+    return Divergence::NanPayloadOnly;
+  return std::nullopt;
+}
+
+std::optional<dfw::Divergence> dfw::ClassifyOutcome(bool v8_timeout, int v8_signal, bool moz_timeout, int moz_signal) {
+  // A timed out runner is killed by the coordinator, its signal tells nothing
+  if(v8_timeout != moz_timeout)
+    return Divergence::TimeoutAsymmetry;
+  if(!v8_timeout && v8_signal != moz_signal)
+    return Divergence::SignalAsymmetry;
+  return std::nullopt;
+}
+
+dfw::DivergenceCounters& dfw::DivergenceCounters::operator+=(DivergenceCounters const& other) {
+  for(size_t i = 0; i < counts.size(); i++)
+    counts[i].fetch_add(other.counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+  return *this;
+}
+
+void dfw::DivergenceCounters::Print(std::ostream& out) const {
+  bool any = false;
+  for(size_t i = 0; i < counts.size(); i++) {
+    auto count = counts[i].load(std::memory_order_relaxed);
+    if(count == 0)
+      continue;
+    out << (any ? " " : "") << DivergenceName((Divergence)i) << "=" << count;
+    any = true;
+  }
+  if(!any)
+    out << "none";
+}
@@ -0,0 +1,53 @@
+#ifndef DIVERGENCE_H
+#define DIVERGENCE_H
+
+#include "runner-common.h"
+
+#include <array>
+#include <atomic>
+#include <optional>
+#include <ostream>
+
+namespace dfw {
+
+// Ways in which the two engines disagreed on a call or on a whole test case
+enum class Divergence : uint8_t {
+  ResultMismatch,      // Both returned, with different values
+  TrapAsymmetry,       // Only one of them trapped
+  MemoryDiffMismatch,  // Different changes of the linear memory
+  GlobalDiffMismatch,  // Different changes of the globals
+  SignalAsymmetry,     // The runners died with different signals
+  TimeoutAsymmetry,    // Only one of the runners timed out
+  NanPayloadOnly,      // Results or globals only differ in the payload of a NaN
+  MemoryStateMismatch, // The memories differ after the last compared call
+  Count
+};
+
+char const* DivergenceName(Divergence category);
+
+// NaN payloads are not specified by WebAssembly, so such a divergence is
+// recorded but does not count as a disagreement of the engines
+inline bool IsBenign(Divergence category) { return category == Divergence::NanPayloadOnly; }
+
+// Classify a pair of call records, nullopt when both engines agree
+std::optional<Divergence> ClassifyCall(CallRecord const& v8_exec, CallRecord const& moz_exec);
+
+// Classify how the runners of a test case ended, nullopt when they ended alike
+std::optional<Divergence> ClassifyOutcome(bool v8_timeout, int v8_signal, bool moz_timeout, int moz_signal);
+
+// Number of divergences per category, updated from any thread
+class DivergenceCounters {
+  std::array<std::atomic<uint64_t>, (size_t)Divergence::Count> counts {};
+
+public:
+  void Add(Divergence category) { counts[(size_t)category].fetch_add(1, std::memory_order_relaxed); }
+  uint64_t Get(Divergence category) const { return counts[(size_t)category].load(std::memory_order_relaxed); }
+
+  DivergenceCounters& operator+=(DivergenceCounters const& other);
+  // Print the non-zero counters as name=count
+  void Print(std::ostream& out) const;
+};
+
+}
+
+#endif
@@ -69,6 +69,19 @@ namespace dfw::db {
     (before)
     (after))
 
+  QUINCE_MAP_CLASS(Divergence,
+    (id)
+    (memorystepping_id)
+    (sequence)
+    (category))
+
+  QUINCE_MAP_CLASS(SteppingModule,
+    (id)
+    (stepping_id)
+    (hash)
+    (size)
+    (executed))
+
   struct Entities::Internal {
     quince_sqlite::database db;
     quince::serial_table<SeedSuite> seed_suites;
@@ -81,6 +94,8 @@ namespace dfw::db {
     quince::serial_table<MemoryDiff> memory_diffs;
     quince::serial_table<GlobalDiff> global_diffs;
     quince::serial_table<FunctionArgs> function_args;
+    quince::serial_table<Divergence> divergences;
+    quince::serial_table<SteppingModule> stepping_modules;
 
     std::optional<quince::transaction> tx;
     
@@ -95,7 +110,9 @@ namespace dfw::db {
         testcase_calls{db},
         memory_diffs{db},
         global_diffs{db},
-        function_args{db} { 
+        function_args{db},
+        divergences{db},
+        stepping_modules{db} { 
         
       // Open tables
       seed_suites.open();
@@ -128,6 +145,12 @@ namespace dfw::db {
       function_args.specify_foreign(function_args->functioncall_id, function_calls, function_calls->id);
       function_args.open();
 
+      divergences.specify_foreign(divergences->memorystepping_id, memory_steppings, memory_steppings->id);
+      divergences.open();
+
+      stepping_modules.specify_foreign(stepping_modules->stepping_id, steppings, steppings->id);
+      stepping_modules.open();
+
       if(initialize_new_db) {
         InitNewDb();
       }
@@ -180,6 +203,14 @@ namespace dfw::db {
     );
   }
 
+  void Entities::UpdateTestCase(quince::serial id, quince::serial memorystepping_id, int implementation_id, int64_t timestamp, bool success, bool timeout, int signal) {
+    this->internal->testcases.update(
+      TestCase {
+        id, memorystepping_id, implementation_id, timestamp, success, timeout, signal
+      }
+    );
+  }
+
   quince::serial Entities::StoreFunctionCall(FunctionCall obj) {
     return this->internal->function_calls.insert(obj);
   }
@@ -199,4 +230,12 @@ namespace dfw::db {
   quince::serial Entities::StoreGlobalDiff(GlobalDiff obj) {
     return this->internal->global_diffs.insert(obj);
   }
+
+  quince::serial Entities::StoreDivergence(Divergence obj) {
+    return this->internal->divergences.insert(obj);
+  }
+
+  quince::serial Entities::StoreSteppingModule(SteppingModule obj) {
+    return this->internal->stepping_modules.insert(obj);
+  }
 }
\ No newline at end of file
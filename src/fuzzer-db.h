@@ -108,6 +108,31 @@ namespace dfw::db {
     static constexpr auto primary_key { &GlobalDiff::id };
   };
 
+  // A classified disagreement of the engines, the sequence of the call or none
+  // when the test cases as a whole ended differently
+  struct Divergence {
+    quince::serial id;
+    quince::serial memorystepping_id;
+    boost::optional<int64_t> sequence;
+    std::string category;
+
+    static constexpr std::string_view table_name { "divergences" };
+    static constexpr auto primary_key { &Divergence::id };
+  };
+
+  // The module of a stepping by the hash of its content, which names the file
+  // in the module store. Duplicates of a module may not have been executed.
+  struct SteppingModule {
+    quince::serial id;
+    quince::serial stepping_id;
+    std::string hash;
+    int64_t size;
+    bool executed;
+
+    static constexpr std::string_view table_name { "stepping_modules" };
+    static constexpr auto primary_key { &SteppingModule::id };
+  };
+
   class Entities {
     struct Internal;
 
@@ -126,11 +151,14 @@ namespace dfw::db {
     quince::serial StoreStepping(quince::serial seed_id, int64_t step);
     quince::serial StoreMemoryStepping(quince::serial stepping_id, int64_t step, int64_t arg_seed);
     quince::serial StoreTestCase(quince::serial memorystepping_id, int implementation_id, int64_t timestamp, bool success, bool timeout, int signal);
+    void UpdateTestCase(quince::serial id, quince::serial memorystepping_id, int implementation_id, int64_t timestamp, bool success, bool timeout, int signal);
     quince::serial StoreFunctionCall(FunctionCall obj);
     quince::serial StoreTestCaseCall(TestCaseCall obj);
     quince::serial StoreFunctionArgs(FunctionArgs obj);
     quince::serial StoreMemoryDiff(MemoryDiff obj);
     quince::serial StoreGlobalDiff(GlobalDiff obj);
+    quince::serial StoreDivergence(Divergence obj);
+    quince::serial StoreSteppingModule(SteppingModule obj);
 
     void Flush();
   };
@@ -0,0 +1,53 @@
+#include "mapped-file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+dfw::MappedFile::MappedFile(MappedFile&& other) :
+  bytes(std::exchange(other.bytes, nullptr)), length(std::exchange(other.length, 0)) { }
+
+dfw::MappedFile& dfw::MappedFile::operator=(MappedFile&& other) {
+  if(this != &other) {
+    if(bytes != nullptr)
+      munmap(bytes, length);
+    bytes = std::exchange(other.bytes, nullptr);
+    length = std::exchange(other.length, 0);
+  }
+  return *this;
+}
+
+dfw::MappedFile::~MappedFile() {
+  if(bytes != nullptr)
+    munmap(bytes, length);
+}
+
+std::optional<dfw::MappedFile> dfw::MappedFile::Open(char const* file_name) {
+  int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return std::nullopt;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    return std::nullopt;
+  }
+
+  MappedFile ret;
+  if(st.st_size > 0) {
+    // Writable but private, writes never reach the file
+    void* addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(addr == MAP_FAILED) {
+      close(fd);
+      return std::nullopt;
+    }
+    ret.bytes = (uint8_t*)addr;
+    ret.length = st.st_size;
+  }
+
+  // The mapping holds its own reference to the file
+  close(fd);
+  return ret;
+}
@@ -0,0 +1,36 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace dfw {
+
+// Private mapping of a whole file. Pages are read from the page cache when
+// first touched and copied only when written to, the file and other mappings
+// of it keep their contents.
+class MappedFile {
+  uint8_t* bytes { nullptr };
+  size_t length { 0 };
+
+public:
+  MappedFile() = default;
+  MappedFile(MappedFile&& other);
+  MappedFile& operator=(MappedFile&& other);
+  MappedFile(MappedFile const&) = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+  ~MappedFile();
+
+  // nullopt if the file cannot be opened or mapped, an empty file maps to no bytes
+  static std::optional<MappedFile> Open(char const* file_name);
+
+  uint8_t* Data() const { return bytes; }
+  size_t Size() const { return length; }
+  std::span<uint8_t> Bytes() const { return { bytes, length }; }
+};
+
+}
+
+#endif
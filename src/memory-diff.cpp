@@ -0,0 +1,116 @@
+#include "memory-diff.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MEMORY_DIFF_X86
+#endif
+
+namespace {
+  // Bytes compared per step of the vectorized loops
+  constexpr size_t BlockSize = 64;
+
+  // Append the changed bytes of [begin, end) to the ranges, extending the
+  // last range if it ends right before the first changed byte
+  void DiffBytes(uint8_t* snapshot, uint8_t const* memory, size_t begin, size_t end,
+                 std::vector<dfw::MemoryRange>& ranges) {
+    for(size_t i = begin; i < end; ++i) {
+      if(snapshot[i] == memory[i])
+        continue;
+      if(ranges.empty() || ranges.back().offset + ranges.back().after.size() != i)
+        ranges.push_back(dfw::MemoryRange { (uint32_t)i, {}, {} });
+      ranges.back().before.push_back(snapshot[i]);
+      ranges.back().after.push_back(memory[i]);
+      snapshot[i] = memory[i];
+    }
+  }
+
+  // Compare whole blocks from begin on, returns where the comparison stopped,
+  // the rest up to end is left to the caller
+  using DiffBlocks = size_t (*)(uint8_t*, uint8_t const*, size_t, size_t, std::vector<dfw::MemoryRange>&);
+
+  size_t DiffBlocksScalar(uint8_t* snapshot, uint8_t const* memory, size_t begin, size_t end,
+                          std::vector<dfw::MemoryRange>& ranges) {
+    size_t i = begin;
+    for(; i + sizeof(uint64_t) <= end; i += sizeof(uint64_t)) {
+      uint64_t a, b;
+      std::memcpy(&a, snapshot + i, sizeof(a));
+      std::memcpy(&b, memory + i, sizeof(b));
+      if(a != b)
+        DiffBytes(snapshot, memory, i, i + sizeof(uint64_t), ranges);
+    }
+    return i;
+  }
+
+#ifdef MEMORY_DIFF_X86
+  __attribute__((target("sse2")))
+  size_t DiffBlocksSSE2(uint8_t* snapshot, uint8_t const* memory, size_t begin, size_t end,
+                        std::vector<dfw::MemoryRange>& ranges) {
+    size_t i = begin;
+    for(; i + BlockSize <= end; i += BlockSize) {
+      __m128i equal = _mm_set1_epi8(-1);
+      for(size_t j = 0; j < BlockSize; j += sizeof(__m128i)) {
+        __m128i a = _mm_loadu_si128((__m128i const*)(snapshot + i + j));
+        __m128i b = _mm_loadu_si128((__m128i const*)(memory + i + j));
+        equal = _mm_and_si128(equal, _mm_cmpeq_epi8(a, b));
+      }
+      if(_mm_movemask_epi8(equal) != 0xFFFF)
+        DiffBytes(snapshot, memory, i, i + BlockSize, ranges);
+    }
+    return i;
+  }
+
+  __attribute__((target("avx2")))
+  size_t DiffBlocksAVX2(uint8_t* snapshot, uint8_t const* memory, size_t begin, size_t end,
+                        std::vector<dfw::MemoryRange>& ranges) {
+    size_t i = begin;
+    for(; i + BlockSize <= end; i += BlockSize) {
+      __m256i a0 = _mm256_loadu_si256((__m256i const*)(snapshot + i));
+      __m256i b0 = _mm256_loadu_si256((__m256i const*)(memory + i));
+      __m256i a1 = _mm256_loadu_si256((__m256i const*)(snapshot + i + sizeof(__m256i)));
+      __m256i b1 = _mm256_loadu_si256((__m256i const*)(memory + i + sizeof(__m256i)));
+      __m256i differ = _mm256_or_si256(_mm256_xor_si256(a0, b0), _mm256_xor_si256(a1, b1));
+      if(!_mm256_testz_si256(differ, differ))
+        DiffBytes(snapshot, memory, i, i + BlockSize, ranges);
+    }
+    return i;
+  }
+#endif
+
+  DiffBlocks SelectDiffBlocks() {
+#ifdef MEMORY_DIFF_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+      return DiffBlocksAVX2;
+    if(__builtin_cpu_supports("sse2"))
+      return DiffBlocksSSE2;
+#endif
+    return DiffBlocksScalar;
+  }
+
+  void DiffSpan(uint8_t* snapshot, uint8_t const* memory, size_t begin, size_t end,
+                std::vector<dfw::MemoryRange>& ranges) {
+    static DiffBlocks const diff_blocks = SelectDiffBlocks();
+    size_t compared = diff_blocks(snapshot, memory, begin, end, ranges);
+    DiffBytes(snapshot, memory, compared, end, ranges);
+  }
+}
+
+std::vector<dfw::MemoryRange> dfw::DiffMemory(std::span<uint8_t> snapshot, uint8_t const* memory, size_t length) {
+  std::vector<MemoryRange> ranges;
+  DiffSpan(snapshot.data(), memory, 0, std::min(length, snapshot.size()), ranges);
+  return ranges;
+}
+
+std::vector<dfw::MemoryRange> dfw::DiffMemory(std::span<uint8_t> snapshot, uint8_t const* memory, size_t length,
+                                              std::vector<std::pair<size_t, size_t>> const& spans) {
+  std::vector<MemoryRange> ranges;
+  length = std::min(length, snapshot.size());
+  for(auto [begin, end] : spans) {
+    if(begin < length)
+      DiffSpan(snapshot.data(), memory, begin, std::min(end, length), ranges);
+  }
+  return ranges;
+}
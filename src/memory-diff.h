@@ -0,0 +1,21 @@
+#ifndef MEMORY_DIFF_H
+#define MEMORY_DIFF_H
+
+#include "runner-common.h"
+
+namespace dfw {
+
+// Compare the wasm memory with the snapshot taken after the previous call and
+// bring the snapshot up to date. Returns the changed bytes as ranges of
+// consecutive bytes, in ascending order. Blocks of equal bytes are skipped
+// with the widest vector instructions the CPU supports.
+std::vector<MemoryRange> DiffMemory(std::span<uint8_t> snapshot, uint8_t const* memory, size_t length);
+
+// Same as above, but only the given spans [begin, end) of the memory are
+// compared, which must be sorted and must not overlap
+std::vector<MemoryRange> DiffMemory(std::span<uint8_t> snapshot, uint8_t const* memory, size_t length,
+                                    std::vector<std::pair<size_t, size_t>> const& spans);
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "memory-hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+  uint64_t Mix(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDull;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ull;
+    return value ^ (value >> 33);
+  }
+
+  uint64_t Combine(uint64_t left, uint64_t right) {
+    return Mix(left * 0x9E3779B97F4A7C15ull ^ right);
+  }
+}
+
+uint64_t dfw::HashBytes(std::span<uint8_t const> bytes, uint64_t seed) {
+  // Four independent lanes keep the multiplications in flight
+  uint64_t lanes[4] = { seed, seed ^ 0x5555, seed ^ 0xAAAA, seed ^ 0xFFFF };
+  size_t i = 0;
+  for(; i + 4 * sizeof(uint64_t) <= bytes.size(); i += 4 * sizeof(uint64_t)) {
+    uint64_t words[4];
+    std::memcpy(words, &bytes[i], sizeof(words));
+    for(size_t l = 0; l < 4; l++)
+      lanes[l] = (lanes[l] ^ words[l]) * 0x100000001B3ull + (lanes[l] >> 31);
+  }
+  for(; i < bytes.size(); i++)
+    lanes[0] = (lanes[0] ^ bytes[i]) * 0x100000001B3ull;
+
+  return Combine(Combine(lanes[0], lanes[1]), Combine(lanes[2], lanes[3]));
+}
+
+uint64_t dfw::PageHashTree::HashPage(std::span<uint8_t const> memory, size_t page) const {
+  size_t begin = page * PageSize;
+  size_t end = std::min(begin + PageSize, memory.size());
+  return HashBytes(memory.subspan(begin, end - begin), page);
+}
+
+void dfw::PageHashTree::UpdatePath(size_t node) {
+  for(node /= 2; node >= 1; node /= 2)
+    nodes[node] = Combine(nodes[2 * node], nodes[2 * node + 1]);
+}
+
+dfw::PageHashTree::PageHashTree(std::span<uint8_t const> memory) {
+  pages = (memory.size() + PageSize - 1) / PageSize;
+  while(leaves < pages)
+    leaves *= 2;
+
+  // Missing pages of the last level hash to zero
+  nodes.assign(2 * leaves, 0);
+  for(size_t page = 0; page < pages; page++)
+    nodes[leaves + page] = HashPage(memory, page);
+  for(size_t node = leaves - 1; node >= 1; node--)
+    nodes[node] = Combine(nodes[2 * node], nodes[2 * node + 1]);
+}
+
+void dfw::PageHashTree::Update(std::span<uint8_t const> memory, std::vector<MemoryRange> const& changed) {
+  // The ranges are sorted, so a page shared by consecutive ranges is hashed once
+  size_t last = SIZE_MAX;
+  for(auto& range : changed) {
+    size_t first_page = range.offset / PageSize;
+    size_t last_page = (range.offset + range.after.size() - 1) / PageSize;
+    for(size_t page = std::max(first_page, last == SIZE_MAX ? 0 : last + 1); page <= last_page && page < pages; page++) {
+      nodes[leaves + page] = HashPage(memory, page);
+      UpdatePath(leaves + page);
+      last = page;
+    }
+  }
+}
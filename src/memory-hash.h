@@ -0,0 +1,38 @@
+#ifndef MEMORY_HASH_H
+#define MEMORY_HASH_H
+
+#include "runner-common.h"
+
+namespace dfw {
+
+// 64-bit hash of the bytes, not meant to resist collisions made on purpose
+uint64_t HashBytes(std::span<uint8_t const> bytes, uint64_t seed = 0);
+
+// Hashes of the pages of a memory snapshot in a binary hash tree, so the state
+// of the whole memory is summed up by the root. After a call only the pages in
+// the diff are hashed again, together with their path to the root. Memories of
+// both engines with the same contents have the same root.
+class PageHashTree {
+  std::vector<uint64_t> nodes; // Heap order, the leaves start at index leaves
+  size_t leaves { 1 };
+  size_t pages { 0 };
+
+  uint64_t HashPage(std::span<uint8_t const> memory, size_t page) const;
+  void UpdatePath(size_t node);
+
+public:
+  static constexpr size_t PageSize = 4096;
+
+  PageHashTree(std::span<uint8_t const> memory);
+
+  // Rehash the pages touched by the ranges, the memory must already hold the new contents
+  void Update(std::span<uint8_t const> memory, std::vector<MemoryRange> const& changed);
+
+  uint64_t Root() const { return nodes[1]; }
+  size_t Pages() const { return pages; }
+  uint64_t PageHash(size_t page) const { return nodes[leaves + page]; }
+};
+
+}
+
+#endif
@@ -0,0 +1,168 @@
+#include "random-engine.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RANDOM_ENGINE_X86
+#endif
+
+namespace {
+  constexpr uint32_t Multiplier0 = 0xD2511F53;
+  constexpr uint32_t Multiplier1 = 0xCD9E8D57;
+  constexpr uint32_t Weyl0 = 0x9E3779B9;
+  constexpr uint32_t Weyl1 = 0xBB67AE85;
+  constexpr int Rounds = 10;
+
+  // Write blocks of consecutive counters starting at counter, returns the
+  // number of blocks written. The caller finishes the rest.
+  using FillBlocks = size_t (*)(uint32_t* out, size_t blocks, 
+                                std::array<uint32_t, 4> const& counter, std::array<uint32_t, 2> const& key);
+
+  size_t FillBlocksScalar(uint32_t*, size_t, std::array<uint32_t, 4> const&, std::array<uint32_t, 2> const&) {
+    return 0;
+  }
+
+#ifdef RANDOM_ENGINE_X86
+  // Upper and lower halves of the 32x32 bit products of every lane
+  __attribute__((target("avx2")))
+  void MultiplyAVX2(__m256i value, __m256i multiplier, __m256i& hi, __m256i& lo) {
+    __m256i even = _mm256_mul_epu32(value, multiplier);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), multiplier);
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+    lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+  }
+
+  // Eight blocks side by side, one per lane
+  __attribute__((target("avx2")))
+  size_t FillBlocksAVX2(uint32_t* out, size_t blocks, 
+                        std::array<uint32_t, 4> const& counter, std::array<uint32_t, 2> const& key) {
+    constexpr size_t Lanes = 8;
+    // The lanes cannot carry into the second word of the counter
+    if(counter[0] > UINT32_MAX - Lanes)
+      return 0;
+    blocks = std::min<size_t>(blocks, (UINT32_MAX - counter[0]) / Lanes * Lanes);
+
+    __m256i const multiplier0 = _mm256_set1_epi32(Multiplier0);
+    __m256i const multiplier1 = _mm256_set1_epi32(Multiplier1);
+    __m256i next = _mm256_add_epi32(_mm256_set1_epi32(counter[0]), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+    size_t done = 0;
+    for(; done + Lanes <= blocks; done += Lanes) {
+      __m256i c0 = next, c1 = _mm256_set1_epi32(counter[1]);
+      __m256i c2 = _mm256_set1_epi32(counter[2]), c3 = _mm256_set1_epi32(counter[3]);
+      uint32_t k0 = key[0], k1 = key[1];
+      for(int round = 0; round < Rounds; round++) {
+        __m256i hi0, lo0, hi1, lo1;
+        MultiplyAVX2(c0, multiplier0, hi0, lo0);
+        MultiplyAVX2(c2, multiplier1, hi1, lo1);
+        c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(k0));
+        c1 = lo1;
+        c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(k1));
+        c3 = lo0;
+        k0 += Weyl0;
+        k1 += Weyl1;
+      }
+
+      // Transpose, so the four words of every block are consecutive
+      __m256i t01lo = _mm256_unpacklo_epi32(c0, c1), t01hi = _mm256_unpackhi_epi32(c0, c1);
+      __m256i t23lo = _mm256_unpacklo_epi32(c2, c3), t23hi = _mm256_unpackhi_epi32(c2, c3);
+      __m256i b04 = _mm256_unpacklo_epi64(t01lo, t23lo), b15 = _mm256_unpackhi_epi64(t01lo, t23lo);
+      __m256i b26 = _mm256_unpacklo_epi64(t01hi, t23hi), b37 = _mm256_unpackhi_epi64(t01hi, t23hi);
+      auto dest = (__m256i*)(out + done * 4);
+      _mm256_storeu_si256(dest + 0, _mm256_permute2x128_si256(b04, b15, 0x20));
+      _mm256_storeu_si256(dest + 1, _mm256_permute2x128_si256(b26, b37, 0x20));
+      _mm256_storeu_si256(dest + 2, _mm256_permute2x128_si256(b04, b15, 0x31));
+      _mm256_storeu_si256(dest + 3, _mm256_permute2x128_si256(b26, b37, 0x31));
+
+      next = _mm256_add_epi32(next, _mm256_set1_epi32(Lanes));
+    }
+    return done;
+  }
+#endif
+
+  FillBlocks SelectFillBlocks() {
+#ifdef RANDOM_ENGINE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+      return FillBlocksAVX2;
+#endif
+    return FillBlocksScalar;
+  }
+}
+
+std::array<uint32_t, 4> dfw::Philox4x32::Block(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key) {
+  for(int round = 0; round < Rounds; round++) {
+    uint64_t product0 = (uint64_t)Multiplier0 * counter[0];
+    uint64_t product1 = (uint64_t)Multiplier1 * counter[2];
+    counter = { (uint32_t)(product1 >> 32) ^ counter[1] ^ key[0], (uint32_t)product1,
+                (uint32_t)(product0 >> 32) ^ counter[3] ^ key[1], (uint32_t)product0 };
+    key[0] += Weyl0;
+    key[1] += Weyl1;
+  }
+  return counter;
+}
+
+dfw::Philox4x32::Philox4x32(uint64_t seed, uint64_t stream) :
+  key { (uint32_t)seed, (uint32_t)(seed >> 32) },
+  counter { 0, 0, (uint32_t)stream, (uint32_t)(stream >> 32) } { }
+
+void dfw::Philox4x32::NextBlock() {
+  block = Block(counter, key);
+  used = 0;
+  // The lower half of the counter is the position in the stream
+  if(++counter[0] == 0)
+    ++counter[1];
+}
+
+void dfw::Philox4x32::Fill(uint32_t* out, size_t count) {
+  size_t i = 0;
+  for(; i < count && used < block.size(); i++)
+    out[i] = block[used++];
+
+  // Whole blocks straight into the output
+  static FillBlocks const fill_blocks = SelectFillBlocks();
+  size_t filled = fill_blocks(out + i, (count - i) / block.size(), counter, key);
+  i += filled * block.size();
+  uint64_t position = ((uint64_t)counter[1] << 32 | counter[0]) + filled;
+  counter[0] = (uint32_t)position;
+  counter[1] = (uint32_t)(position >> 32);
+
+  for(; i + block.size() <= count; i += block.size()) {
+    auto next = Block(counter, key);
+    for(size_t j = 0; j < next.size(); j++)
+      out[i + j] = next[j];
+    if(++counter[0] == 0)
+      ++counter[1];
+  }
+
+  for(; i < count; i++)
+    out[i] = (*this)();
+}
+
+std::optional<dfw::RandomFill> dfw::ParseRandomFill(char const* name) {
+  if(std::strcmp(name, "philox") == 0)
+    return RandomFill::Philox;
+  else if(std::strcmp(name, "mt19937") == 0)
+    return RandomFill::Mt19937;
+  return std::nullopt;
+}
+
+dfw::RandomFiller::RandomFiller(RandomFill generator, uint64_t seed, uint64_t stream) :
+  generator(generator), philox(seed, stream), mt(seed) { }
+
+void dfw::RandomFiller::Fill(std::span<uint8_t> out) {
+  auto words = (uint32_t*)out.data();
+  size_t count = out.size() / sizeof(uint32_t);
+  if(generator == RandomFill::Mt19937) {
+    std::for_each(words, words + count, [&] (uint32_t& val) { val = mt(); });
+    return;
+  }
+
+  philox.Fill(words, count);
+  if(size_t rest = out.size() % sizeof(uint32_t); rest != 0) {
+    uint32_t last = philox();
+    std::memcpy(out.data() + count * sizeof(uint32_t), &last, rest);
+  }
+}
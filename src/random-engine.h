@@ -0,0 +1,73 @@
+#ifndef RANDOM_ENGINE_H
+#define RANDOM_ENGINE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <random>
+#include <span>
+
+namespace dfw {
+
+// Counter-based Philox4x32-10 generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"). Each block of four outputs is a function of
+// the key and of a 128-bit counter only. A stream is the upper half of the
+// counter, so any stream of a seed starts in constant time and the streams
+// never overlap.
+class Philox4x32 {
+  std::array<uint32_t, 2> key;
+  std::array<uint32_t, 4> counter;
+  std::array<uint32_t, 4> block;
+  size_t used { 4 }; // Outputs of the block already returned
+
+  void NextBlock();
+
+public:
+  using result_type = uint32_t;
+
+  Philox4x32(uint64_t seed, uint64_t stream = 0);
+
+  static std::array<uint32_t, 4> Block(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key);
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+  result_type operator()() {
+    if(used == block.size())
+      NextBlock();
+    return block[used++];
+  }
+
+  // Write the next count outputs, same as calling the generator count times.
+  // Whole blocks are computed eight at a time with AVX2 if the CPU has it.
+  void Fill(uint32_t* out, size_t count);
+};
+
+// Generator behind the bulk random data
+enum class RandomFill {
+  Philox, // Philox4x32, vectorized
+  Mt19937 // One std::mt19937 draw per word, the data of campaigns before philox
+};
+
+std::optional<RandomFill> ParseRandomFill(char const* name);
+
+// Fills buffers with random data, each Fill continues where the previous one
+// stopped. The words are stored in the byte order of the host.
+class RandomFiller {
+  RandomFill generator;
+  Philox4x32 philox;
+  std::mt19937 mt;
+
+public:
+  // The stream only applies to philox, mt19937 takes the lower 32 bits of the seed
+  RandomFiller(RandomFill generator, uint64_t seed, uint64_t stream = 0);
+
+  // Philox fills every byte, mt19937 leaves a partial word at the end as it is
+  void Fill(std::span<uint8_t> out);
+};
+
+}
+
+#endif
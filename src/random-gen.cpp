@@ -1,5 +1,6 @@
 
 #include "runner-common.h"
+#include "random-engine.h"
 
 #include <sys/stat.h> 
 #include <sys/types.h> 
@@ -23,6 +24,10 @@ struct CommandLineArgument {
   dfw::CommandLineArg<char const*> outfile { "-output", true };
   dfw::CommandLineArg<char const*> memory { "-memory", true };
 
+  // Generator of the random blocks, philox or mt19937 to repeat campaigns
+  // started before philox was introduced
+  dfw::CommandLineArg<char const*> rng { "-rng", false, "philox" };
+
   CommandLineArgument(int argc, char const* argv[]) {
     dfw::CommandLineConsumer { argc, argv, 
                           std::ref(randomSize),
@@ -31,26 +36,53 @@ struct CommandLineArgument {
                           std::ref(outfile),
                           std::ref(memory),
                           std::ref(skipMemoryCount),
-                          std::ref(repro) };
+                          std::ref(repro),
+                          std::ref(rng) };
+  }
+};
+
+// Source of the random block of every module. With philox the block of a
+// step is the stream of that step, so skipping steps takes constant time and
+// the lanes, which differ in their seed, never share a stream.
+class BlockSource {
+  uint64_t seed;
+  uint64_t step { 0 };
+  bool legacy;
+  std::mt19937 legacy_re;
+
+public:
+  BlockSource(uint64_t seed, dfw::RandomFill generator) : 
+    seed(seed), legacy(generator == dfw::RandomFill::Mt19937), legacy_re(seed) { }
+
+  // Continue with the block of the given step, which must not be before the current one
+  void Skip(uint64_t target, size_t block_size) {
+    if(legacy && target > step)
+      legacy_re.discard((target - step) * (block_size / sizeof(uint32_t)));
+    step = target;
+  }
+
+  void Fill(std::vector<uint8_t>& block) {
+    if(legacy) {
+      auto begin = (uint32_t*)block.data();
+      std::for_each(begin, begin + block.size() / sizeof(uint32_t), [&] (uint32_t& val) { val = legacy_re(); });
+    } else {
+      dfw::RandomFiller { dfw::RandomFill::Philox, seed, step }.Fill(block);
+    }
+    step++;
   }
 };
 
-size_t GenerateRandomWASM(CommandLineArgument& args, 
+std::tuple<size_t, size_t> GenerateRandomWASM(char const* outfile, 
                         std::vector<uint8_t>& randomizedData,
-                        std::mt19937& re,
+                        BlockSource& re,
                         v8::Isolate* isolate) {
   // Generate the random WASM
-  auto dataBeginAsInt32 = (uint32_t*) randomizedData.data();
-  auto dataEndAsInt32 = dataBeginAsInt32 + randomizedData.size() / sizeof(uint32_t);
-
-  std::for_each(dataBeginAsInt32, 
-                dataEndAsInt32, 
-                [&] (uint32_t& val) { val = re(); });
+  re.Fill(randomizedData);
   
   //std::cout << "Generating WASM...\n";
   std::vector<uint8_t> generatedWasm;
 
-  std::ofstream output(args.outfile, std::ios::out);
+  std::ofstream output(outfile, std::ios::out);
   auto [success, mem_size_ret] = v8::ext::GenerateRandomWasm(isolate, randomizedData, generatedWasm);
 
   //std::cout << "Memory size: " << mem_size_ret << std::endl;
@@ -67,12 +99,13 @@ size_t GenerateRandomWASM(CommandLineArgument& args,
   output.write((char const*)generatedWasm.data(), generatedWasm.size());
   output.flush();
 
-  return mem_size_ret;
+  return { generatedWasm.size(), mem_size_ret };
 }
-std::vector<uint32_t> mem_page_buffer;
+std::vector<uint8_t> mem_page_buffer;
 
 
 void GenerateMemory(CommandLineArgument& args, 
+                    dfw::RandomFill generator,
                     std::vector<uint8_t>& randomizedData, 
                     size_t mem_seed_ptr,
                     size_t mem_size) {
@@ -83,20 +116,16 @@ void GenerateMemory(CommandLineArgument& args,
   auto maxIndex = randomizedData.size() / sizeof(uint32_t);
   auto seed = dataBeginAsInt32[mem_seed_ptr % maxIndex];
 
-  std::mt19937 re_mem;
-  re_mem.seed(seed);
+  dfw::RandomFiller re_mem { generator, seed };
 
   // Generate n bytes of memory output
   std::ofstream mem_output(args.memory, std::ios::out);
 
   for(int i = 0; i < mem_size; ++i) {
     // Generate one block
-    for(int i = 0; i < mem_page_buffer.size(); ++i) {
-      mem_page_buffer[i] = re_mem();
-    }
+    re_mem.Fill(mem_page_buffer);
     // Write one block
-    mem_output.write((char const*)mem_page_buffer.data(),
-                      mem_page_buffer.size() * sizeof(decltype(mem_page_buffer)::value_type));
+    mem_output.write((char const*)mem_page_buffer.data(), mem_page_buffer.size());
   }
 
   //std::cout << "m" << std::endl;
@@ -107,19 +136,20 @@ int main(int argc, char const* argv[]) {
   CommandLineArgument args { argc, argv };
 
   // Prepare buffer
-  mem_page_buffer.resize(64 * 1024 / sizeof(uint32_t)); // Single page WASM memory
+  mem_page_buffer.resize(64 * 1024); // Single page WASM memory
 
-  std::mt19937 re(args.randomSeed);
+  auto generator = dfw::ParseRandomFill(args.rng);
+  if(!generator.has_value()) {
+    std::cerr << "Unknown random generator, use philox or mt19937." << std::endl;
+    return 1;
+  }
+  BlockSource re { args.randomSeed, *generator };
 
   size_t mem_seed_ptr;
   size_t mem_size;
   
 
-  if(args.skipCount != 0) {
-    int skippedByteCount = args.skipCount * args.randomSize / sizeof(uint32_t);
-    for(int i = 0; i < skippedByteCount; ++i)
-      re();
-  }
+  re.Skip(args.skipCount, args.randomSize);
 
   std::vector<uint8_t> randomizedData;
   randomizedData.resize(args.randomSize);
@@ -146,21 +176,28 @@ int main(int argc, char const* argv[]) {
 
     if(!args.repro) {
       while(true) {
-        std::getline(std::cin, input);
-        if(input == "q") 
+        // Coordinator closing the pipe also ends the generator
+        if(!std::getline(std::cin, input) || input == "q") 
           break;
-        else if(input == "w") {
-          mem_size = GenerateRandomWASM(args, randomizedData, re, isolate);
+        else if(input == "w" || input.rfind("w ", 0) == 0) {
+          // Optional destination path, defaults to the output argument
+          std::string outfile = input.size() > 2 ? input.substr(2) : std::string { args.outfile };
+          auto [wasm_size, mem_size_ret] = GenerateRandomWASM(outfile.c_str(), randomizedData, re, isolate);
+          mem_size = mem_size_ret;
           // Reset mem seed
           mem_seed_ptr = 0;
+
+          // Acknowledge when the module is completely written
+          std::cout << "ready " << outfile << " " << wasm_size << " " << mem_size << std::endl;
+          std::cout.flush();
         } else if(input == "m") {
-          GenerateMemory(args, randomizedData, mem_seed_ptr, mem_size);
+          GenerateMemory(args, *generator, randomizedData, mem_seed_ptr, mem_size);
           ++mem_seed_ptr;
         }
       }
     } else {
-      mem_size = GenerateRandomWASM(args, randomizedData, re, isolate);
-      GenerateMemory(args, randomizedData, args.skipMemoryCount, mem_size);
+      std::tie(std::ignore, mem_size) = GenerateRandomWASM(args.outfile, randomizedData, re, isolate);
+      GenerateMemory(args, *generator, randomizedData, args.skipMemoryCount, mem_size);
     }
   }
 
@@ -2,29 +2,29 @@
 #include <iterator>
 #include <vector>
 #include <fstream>
+#include <iostream>
+
+#include "random-engine.h"
 
 void GenerateMemory(std::string output_file,
                     size_t mem_size,
-                    uint64_t seed) {
+                    uint64_t seed,
+                    dfw::RandomFill generator) {
   // Generate random memory
-  std::vector<uint32_t> mem_page_buffer;
-  mem_page_buffer.resize(64 * 1024 / sizeof(uint32_t));
+  std::vector<uint8_t> mem_page_buffer;
+  mem_page_buffer.resize(64 * 1024);
   
-  std::mt19937 re_mem;
-  re_mem.seed(seed);
+  dfw::RandomFiller re_mem { generator, seed };
 
   // Generate n bytes of memory output
   std::ofstream mem_output(output_file, std::ios::out);
 
   for(int i = 0; i < mem_size; ++i) {
     // Generate one block
-    for(int i = 0; i < mem_page_buffer.size(); ++i) {
-      mem_page_buffer[i] = re_mem();
-    }
+    re_mem.Fill(mem_page_buffer);
 
     // Write one block
-    mem_output.write((char const*)mem_page_buffer.data(),
-                      mem_page_buffer.size() * sizeof(decltype(mem_page_buffer)::value_type));
+    mem_output.write((char const*)mem_page_buffer.data(), mem_page_buffer.size());
   }
 }
 
@@ -70,9 +70,16 @@ void GenerateOneMemory(std::string output_file, size_t mem_size) {
 
 
 int main(int argc, char const* argv[]) {
+  // mt19937 reproduces the images of earlier campaigns
+  auto generator = dfw::ParseRandomFill(argc > 1 ? argv[1] : "philox");
+  if(!generator.has_value()) {
+    std::cerr << "Need argument: [philox|mt19937]." << std::endl;
+    return 1;
+  }
+
   GenerateZeroMemory("zero.mem", 10);
   GenerateOneMemory("one.mem", 10);
-  GenerateMemory("rand1.mem", 10, 1234567890);
-  GenerateMemory("rand2.mem", 10, 2468012345);
-  GenerateMemory("rand3.mem", 10, 5432101234);
+  GenerateMemory("rand1.mem", 10, 1234567890, *generator);
+  GenerateMemory("rand2.mem", 10, 2468012345, *generator);
+  GenerateMemory("rand3.mem", 10, 5432101234, *generator);
 }
@@ -0,0 +1,180 @@
+#include "result-ring.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+  long Futex(std::atomic<uint32_t>* addr, int op, uint32_t val, struct timespec const* timeout) {
+    // Shared between processes, so not FUTEX_PRIVATE_FLAG
+    return syscall(SYS_futex, (uint32_t*)addr, op, val, timeout, nullptr, 0);
+  }
+}
+
+dfw::ResultRing::ResultRing(ResultRing&& other) {
+  *this = std::move(other);
+}
+
+dfw::ResultRing& dfw::ResultRing::operator=(ResultRing&& other) {
+  std::swap(memory_fd, other.memory_fd);
+  std::swap(event_fd, other.event_fd);
+  std::swap(header, other.header);
+  std::swap(data, other.data);
+  std::swap(map_size, other.map_size);
+  return *this;
+}
+
+dfw::ResultRing::~ResultRing() {
+  if(header != nullptr) munmap(header, map_size);
+  if(memory_fd >= 0) close(memory_fd);
+  if(event_fd >= 0) close(event_fd);
+}
+
+bool dfw::ResultRing::Map(size_t size) {
+  void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+  if(addr == MAP_FAILED)
+    return false;
+
+  map_size = size;
+  header = (Header*)addr;
+  data = (char*)addr + sizeof(Header);
+  return true;
+}
+
+std::optional<dfw::ResultRing> dfw::ResultRing::Create(size_t capacity) {
+  ResultRing ring;
+  ring.memory_fd = memfd_create("result-ring", MFD_CLOEXEC);
+  ring.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if(ring.memory_fd < 0 || ring.event_fd < 0)
+    return std::nullopt;
+
+  size_t size = sizeof(Header) + capacity;
+  if(ftruncate(ring.memory_fd, size) != 0 || !ring.Map(size))
+    return std::nullopt;
+
+  new (ring.header) Header {};
+  ring.header->capacity = capacity;
+  return ring;
+}
+
+std::optional<dfw::ResultRing> dfw::ResultRing::Attach(int memory_fd, int event_fd) {
+  ResultRing ring;
+  ring.memory_fd = memory_fd;
+  ring.event_fd = event_fd;
+
+  // Read the capacity before mapping the whole ring
+  uint32_t capacity;
+  if(pread(memory_fd, &capacity, sizeof(capacity), offsetof(Header, capacity)) != sizeof(capacity))
+    return std::nullopt;
+
+  if(!ring.Map(sizeof(Header) + capacity))
+    return std::nullopt;
+  return ring;
+}
+
+void dfw::ResultRing::Signal() {
+  // Only wake the consumer if it is sleeping on this ring
+  if(header->consumer_armed.exchange(0) != 0) {
+    uint64_t one = 1;
+    write(event_fd, &one, sizeof(one));
+  }
+}
+
+void dfw::ResultRing::Write(char const* buffer, size_t len) {
+  uint64_t capacity = header->capacity;
+  uint64_t head = header->head.load(std::memory_order_relaxed);
+
+  while(len > 0) {
+    uint64_t tail = header->tail.load(std::memory_order_acquire);
+    uint64_t space = capacity - (head - tail);
+
+    if(space == 0) {
+      // Let the consumer drain what is already published, then wait for space
+      uint32_t seq = header->space_seq.load(std::memory_order_acquire);
+      header->producer_waiting.store(1);
+      Signal();
+      if(header->tail.load() == tail) {
+        struct timespec timeout { 0, 100 * 1000 * 1000 };
+        Futex(&header->space_seq, FUTEX_WAIT, seq, &timeout);
+      }
+      header->producer_waiting.store(0);
+      continue;
+    }
+
+    // Copy up to the end of the buffer, wrap around in the next round
+    size_t offset = head % capacity;
+    size_t chunk = std::min<uint64_t>({ len, space, capacity - offset });
+    std::memcpy(data + offset, buffer, chunk);
+    buffer += chunk;
+    len -= chunk;
+    head += chunk;
+    header->head.store(head);
+  }
+
+  Signal();
+}
+
+size_t dfw::ResultRing::Read(std::string& out) {
+  uint64_t capacity = header->capacity;
+  uint64_t tail = header->tail.load(std::memory_order_relaxed);
+  uint64_t head = header->head.load(std::memory_order_acquire);
+  size_t total = head - tail;
+
+  while(tail != head) {
+    size_t offset = tail % capacity;
+    size_t chunk = std::min<uint64_t>(head - tail, capacity - offset);
+    out.append(data + offset, chunk);
+    tail += chunk;
+  }
+  header->tail.store(tail);
+
+  if(total > 0 && header->producer_waiting.load() != 0) {
+    header->space_seq.fetch_add(1, std::memory_order_release);
+    Futex(&header->space_seq, FUTEX_WAKE, 1, nullptr);
+  }
+  return total;
+}
+
+bool dfw::ResultRing::Arm() {
+  header->consumer_armed.store(1);
+  if(header->head.load() != header->tail.load(std::memory_order_relaxed)) {
+    header->consumer_armed.store(0);
+    return false;
+  }
+  return true;
+}
+
+void dfw::ResultRing::Reset() {
+  header->head.store(0);
+  header->tail.store(0);
+  header->producer_waiting.store(0);
+  header->consumer_armed.store(0);
+
+  uint64_t count;
+  read(event_fd, &count, sizeof(count)); // Stale wakeup
+}
+
+dfw::ResultRingBuf::int_type dfw::ResultRingBuf::overflow(int_type ch) {
+  if(ch != traits_type::eof())
+    buffer.push_back((char)ch);
+  return ch;
+}
+
+std::streamsize dfw::ResultRingBuf::xsputn(char const* s, std::streamsize count) {
+  buffer.append(s, count);
+  return count;
+}
+
+int dfw::ResultRingBuf::sync() {
+  if(!buffer.empty()) {
+    ring.Write(buffer.data(), buffer.size());
+    buffer.clear();
+  }
+  return 0;
+}
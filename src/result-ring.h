@@ -0,0 +1,88 @@
+#ifndef RESULT_RING_H
+#define RESULT_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <streambuf>
+#include <string>
+
+// Shared memory of the ring and the eventfd waking up the coordinator
+#define RING_MEMORY_FILE_DESCRIPTOR 5
+#define RING_EVENT_FILE_DESCRIPTOR 6
+
+namespace dfw {
+
+// Single-producer/single-consumer byte ring in a memfd, carrying the result
+// log of a runner to the coordinator without a syscall for every record. The
+// runner is the producer and the coordinator the consumer.
+//
+// The consumer arms the ring before it goes to sleep; the producer writes the
+// eventfd only when it publishes data into an armed ring. The producer waits
+// on a futex when the ring is full, which the consumer wakes after it freed
+// some space.
+class ResultRing {
+  struct Header {
+    std::atomic<uint64_t> head; // Written by the producer
+    std::atomic<uint64_t> tail; // Written by the consumer
+    std::atomic<uint32_t> space_seq;
+    std::atomic<uint32_t> producer_waiting;
+    std::atomic<uint32_t> consumer_armed;
+    uint32_t capacity;
+  };
+
+  int memory_fd { -1 };
+  int event_fd { -1 };
+  Header* header { nullptr };
+  char* data { nullptr };
+  size_t map_size { 0 };
+
+  ResultRing() = default;
+  bool Map(size_t size);
+  void Signal();
+
+public:
+  ResultRing(ResultRing&& other);
+  ResultRing& operator=(ResultRing&& other);
+  ResultRing(ResultRing const&) = delete;
+  ResultRing& operator=(ResultRing const&) = delete;
+  ~ResultRing();
+
+  // Consumer side, capacity in bytes
+  static std::optional<ResultRing> Create(size_t capacity);
+  // Producer side, takes ownership of the file descriptors
+  static std::optional<ResultRing> Attach(int memory_fd, int event_fd);
+
+  int MemoryFd() const { return memory_fd; }
+  int EventFd() const { return event_fd; }
+
+  // Producer: copy the bytes into the ring and publish them, blocks while the ring is full
+  void Write(char const* buffer, size_t len);
+
+  // Consumer: append everything published so far to out, returns the number of bytes
+  size_t Read(std::string& out);
+  // Consumer: request a wakeup for the next publish. Returns false when data
+  // arrived in the meantime, the ring must be read again before sleeping.
+  bool Arm();
+  // Consumer: drop all state of a previous producer
+  void Reset();
+};
+
+// Output stream buffer writing into the ring, published on flush
+class ResultRingBuf : public std::streambuf {
+  ResultRing& ring;
+  std::string buffer;
+
+protected:
+  int_type overflow(int_type ch) override;
+  std::streamsize xsputn(char const* s, std::streamsize count) override;
+  int sync() override;
+
+public:
+  ResultRingBuf(ResultRing& ring) : ring(ring) { }
+  ~ResultRingBuf() { sync(); }
+};
+
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include "runner-common.h"
+#include "result-ring.h"
+#include "memory-diff.h"
+#include "memory-hash.h"
 
 #include <random>
 #include <algorithm>
@@ -9,6 +12,8 @@
 #include <fcntl.h>
 #include <chrono>
 #include <map>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 #include <rapidjson/document.h>
 #include <rapidjson/writer.h>
@@ -126,14 +131,410 @@ void dfw::WriteOutput(char const* fileName, std::vector<uint8_t> const& buf) {
   outputFile.close();
 }
 
-std::vector<uint8_t> dfw::GenerateRandomData(uint64_t seed, uint32_t len) {
-  std::mt19937 re(seed);
+std::vector<uint8_t> dfw::GenerateRandomData(uint64_t seed, uint32_t len, RandomFill generator) {
   std::vector<uint8_t> ret;
   ret.resize(len);
-  std::for_each(ret.begin(), ret.end(), [&] (uint8_t& val) { val = re(); });
+  if(generator == RandomFill::Mt19937) {
+    // Legacy stream, one draw truncated to each byte
+    std::mt19937 re(seed);
+    std::for_each(ret.begin(), ret.end(), [&] (uint8_t& val) { val = re(); });
+  } else {
+    RandomFiller { generator, seed }.Fill(ret);
+  }
   return ret;
 }
 
+bool dfw::SendControlMessage(int socket, std::string const& msg, std::vector<int> const& fds) {
+  struct iovec iov;
+  iov.iov_base = (void*)msg.data();
+  iov.iov_len = msg.size();
+
+  struct msghdr hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+
+  // Attach the file descriptors as ancillary data
+  char control[CMSG_SPACE(sizeof(int) * MAX_CONTROL_FILE_DESCRIPTORS)];
+  if(fds.size() > MAX_CONTROL_FILE_DESCRIPTORS)
+    return false;
+  if(!fds.empty()) {
+    std::memset(control, 0, sizeof(control));
+    hdr.msg_control = control;
+    hdr.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+  }
+
+  return sendmsg(socket, &hdr, MSG_NOSIGNAL) == (ssize_t)msg.size();
+}
+
+std::optional<std::string> dfw::ReceiveControlMessage(int socket, std::vector<int>* fds) {
+  char buffer[4096];
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = sizeof(buffer);
+
+  char control[CMSG_SPACE(sizeof(int) * MAX_CONTROL_FILE_DESCRIPTORS)];
+  struct msghdr hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  hdr.msg_control = control;
+  hdr.msg_controllen = sizeof(control);
+
+  ssize_t len;
+  do {
+    len = recvmsg(socket, &hdr, 0);
+  } while(len < 0 && errno == EINTR);
+
+  // Peer closed the channel
+  if(len <= 0)
+    return std::nullopt;
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+  if(cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+    std::vector<int> received((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    std::memcpy(received.data(), CMSG_DATA(cmsg), sizeof(int) * received.size());
+    if(fds != nullptr) {
+      *fds = std::move(received);
+    } else {
+      for(int fd : received) close(fd); // Nobody takes them
+    }
+  } else if(fds != nullptr) {
+    fds->clear();
+  }
+
+  return std::string { buffer, (size_t)len };
+}
+
+void dfw::InstallFileDescriptors(std::vector<std::pair<int, int>> const& source_target) {
+  // Move everything out of the way first, so no source is overwritten
+  // by the target of another one
+  std::vector<int> moved;
+  for(auto [source, target] : source_target) {
+    moved.push_back(fcntl(source, F_DUPFD_CLOEXEC, 64));
+    close(source);
+  }
+
+  // dup2 clears close-on-exec on the target
+  for(size_t i = 0; i < moved.size(); i++) {
+    dup2(moved[i], source_target[i].second);
+    close(moved[i]);
+  }
+}
+
+bool dfw::ForkSafeEngineRequired(int argc, char const* argv[]) {
+  for(int i = 1; i + 1 < argc; ++i) {
+    if(std::strcmp(argv[i], "-mode") == 0 && std::strcmp(argv[i + 1], "server") == 0)
+      return true;
+  }
+  return false;
+}
+
+std::string dfw::RunnerJob::Serialize() const {
+  std::stringstream ss;
+  ss << input << "\n" << iter_count;
+  for(auto& variant : variants)
+    ss << "\n" << variant.memory << "\n" << variant.arg_seed;
+  return ss.str();
+}
+
+std::optional<dfw::RunnerJob> dfw::RunnerJob::Parse(std::string const& msg) {
+  std::istringstream ss(msg);
+  RunnerJob job;
+  std::string iter_count, memory, arg_seed;
+  if(!std::getline(ss, job.input) || !std::getline(ss, iter_count))
+    return std::nullopt;
+
+  try {
+    job.iter_count = std::stoi(iter_count);
+    while(std::getline(ss, memory)) {
+      if(!std::getline(ss, arg_seed))
+        return std::nullopt;
+      job.variants.push_back(RunnerVariant { memory, std::stoll(arg_seed) });
+    }
+  } catch(std::exception const& ex) {
+    return std::nullopt;
+  }
+  return job;
+}
+
+std::string dfw::RunnerJob::MemoryList() const {
+  std::string ret;
+  for(auto& variant : variants) {
+    if(!ret.empty()) ret += ',';
+    ret += variant.memory;
+  }
+  return ret;
+}
+
+std::string dfw::RunnerJob::ArgSeedList() const {
+  std::string ret;
+  for(auto& variant : variants) {
+    if(!ret.empty()) ret += ',';
+    ret += std::to_string(variant.arg_seed);
+  }
+  return ret;
+}
+
+std::optional<std::vector<dfw::RunnerVariant>> dfw::RunnerJob::ParseVariants(char const* memories, 
+                                                                             char const* arg_seeds) {
+  std::vector<RunnerVariant> ret;
+  std::istringstream memory_str(memories), arg_seed_str(arg_seeds);
+  std::string memory, arg_seed;
+  try {
+    while(std::getline(arg_seed_str, arg_seed, ',')) {
+      if(!std::getline(memory_str, memory, ','))
+        return std::nullopt;
+      ret.push_back(RunnerVariant { memory, std::stoll(arg_seed) });
+    }
+  } catch(std::exception const& ex) {
+    return std::nullopt;
+  }
+
+  // Both list must have the same length
+  if(std::getline(memory_str, memory, ','))
+    return std::nullopt;
+  return ret;
+}
+
+std::optional<dfw::ResultProtocol> dfw::ParseResultProtocol(char const* name) {
+  if(std::strcmp(name, "json") == 0)
+    return ResultProtocol::Json;
+  else if(std::strcmp(name, "binary") == 0)
+    return ResultProtocol::Binary;
+  return std::nullopt;
+}
+
+std::vector<dfw::MemoryRange> dfw::PackMemoryDiff(std::vector<MemoryDiff> const& diff) {
+  std::vector<MemoryRange> ret;
+  for(auto& byte : diff) {
+    // Extend the last range if the byte is right after it
+    if(ret.empty() || ret.back().offset + ret.back().after.size() != byte.index)
+      ret.push_back(MemoryRange { byte.index, {}, {} });
+    ret.back().before.push_back(byte.old_byte);
+    ret.back().after.push_back(byte.new_byte);
+  }
+  return ret;
+}
+
+namespace {
+  // splitmix64 finalizer
+  uint64_t Mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ull;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+  }
+
+  struct Digest {
+    uint64_t state { 0x9E3779B97F4A7C15ull };
+
+    void Add(uint64_t value) { state = Mix(state ^ value) + 0x9E3779B97F4A7C15ull; }
+
+    void Add(std::vector<uint8_t> const& bytes) {
+      Add(bytes.size());
+      size_t i = 0;
+      for(; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, &bytes[i], sizeof(word));
+        Add(word);
+      }
+      uint64_t rest = 0;
+      if(i < bytes.size())
+        std::memcpy(&rest, bytes.data() + i, bytes.size() - i);
+      Add(rest);
+    }
+  };
+}
+
+uint64_t dfw::DigestCallRecord(CallRecord const& record) {
+  // The counts separate the sections, so records with moved fields differ
+  Digest digest;
+  digest.Add(record.function_no);
+  digest.Add(record.args.size());
+  for(auto arg : record.args)
+    digest.Add(arg);
+  digest.Add(record.success);
+  digest.Add(record.result.has_value());
+  digest.Add(record.result.value_or(0));
+  digest.Add(record.memory_diff.size());
+  for(auto& range : record.memory_diff) {
+    digest.Add(range.offset);
+    digest.Add(range.before);
+    digest.Add(range.after);
+  }
+  digest.Add(record.global_diff.size());
+  for(auto& global : record.global_diff) {
+    digest.Add(global.index);
+    digest.Add(global.before);
+    digest.Add(global.after);
+  }
+  digest.Add(record.memory_root.has_value());
+  digest.Add(record.memory_root.value_or(0));
+  return digest.state;
+}
+
+namespace {
+  template<typename T>
+  void Put(std::string& out, T value) {
+    out.append((char const*)&value, sizeof(value));
+  }
+
+  // Bounds checked reading of a frame payload
+  struct FrameReader {
+    char const* pos;
+    char const* end;
+    bool ok { true };
+
+    template<typename T>
+    T Get() {
+      T value {};
+      if(end - pos < (ptrdiff_t)sizeof(T)) {
+        ok = false;
+        return value;
+      }
+      std::memcpy(&value, pos, sizeof(T));
+      pos += sizeof(T);
+      return value;
+    }
+
+    void Bytes(std::vector<uint8_t>& out, size_t len) {
+      if((size_t)(end - pos) < len) {
+        ok = false;
+        return;
+      }
+      out.assign((uint8_t const*)pos, (uint8_t const*)pos + len);
+      pos += len;
+    }
+  };
+
+  void BeginFrame(std::string& out, dfw::FrameKind kind, uint64_t digest) {
+    Put<uint32_t>(out, 0); // Patched by EndFrame
+    Put<uint8_t>(out, (uint8_t)kind);
+    Put<uint64_t>(out, digest);
+  }
+
+  void EndFrame(std::string& out, size_t frame_begin) {
+    uint32_t len = out.size() - frame_begin - sizeof(uint32_t);
+    std::memcpy(&out[frame_begin], &len, sizeof(len));
+  }
+}
+
+void dfw::EncodeCallRecord(std::string& out, CallRecord const& record, uint64_t digest) {
+  size_t frame_begin = out.size();
+  BeginFrame(out, FrameKind::Call, digest);
+  Put<uint32_t>(out, record.function_no);
+  Put<uint8_t>(out, record.success);
+  Put<uint8_t>(out, record.result.has_value());
+  Put<uint8_t>(out, record.memory_root.has_value());
+  Put<uint16_t>(out, record.args.size());
+  Put<uint32_t>(out, record.memory_diff.size());
+  Put<uint32_t>(out, record.global_diff.size());
+  Put<int64_t>(out, record.elapsed);
+  Put<int64_t>(out, record.result.value_or(0));
+  Put<uint64_t>(out, record.memory_root.value_or(0));
+  for(auto arg : record.args)
+    Put<int64_t>(out, arg);
+  for(auto& range : record.memory_diff) {
+    Put<uint32_t>(out, range.offset);
+    Put<uint32_t>(out, range.after.size());
+    out.append((char const*)range.before.data(), range.before.size());
+    out.append((char const*)range.after.data(), range.after.size());
+  }
+  for(auto& global : record.global_diff) {
+    Put<int64_t>(out, global.index);
+    Put<int64_t>(out, global.before);
+    Put<int64_t>(out, global.after);
+  }
+  EndFrame(out, frame_begin);
+}
+
+void dfw::EncodeVariantEnd(std::string& out, bool success, uint64_t digest) {
+  size_t frame_begin = out.size();
+  BeginFrame(out, FrameKind::VariantEnd, digest);
+  Put<uint8_t>(out, success);
+  EndFrame(out, frame_begin);
+}
+
+size_t dfw::PeekFrame(std::string_view buffer, FrameKind& kind, uint64_t& digest) {
+  uint32_t len;
+  if(buffer.size() < sizeof(len))
+    return 0;
+  std::memcpy(&len, buffer.data(), sizeof(len));
+  if(buffer.size() - sizeof(len) < len)
+    return 0;
+
+  FrameReader reader { buffer.data() + sizeof(len), buffer.data() + sizeof(len) + len };
+  kind = (FrameKind)reader.Get<uint8_t>();
+  digest = reader.Get<uint64_t>();
+  if(!reader.ok)
+    kind = FrameKind::Invalid;
+  return sizeof(len) + len;
+}
+
+size_t dfw::DecodeFrame(std::string_view buffer, RecordFrame& frame) {
+  uint32_t len;
+  if(buffer.size() < sizeof(len))
+    return 0;
+  std::memcpy(&len, buffer.data(), sizeof(len));
+  if(buffer.size() - sizeof(len) < len)
+    return 0;
+
+  FrameReader reader { buffer.data() + sizeof(len), buffer.data() + sizeof(len) + len };
+  frame.kind = (FrameKind)reader.Get<uint8_t>();
+  frame.digest = reader.Get<uint64_t>();
+  if(frame.kind == FrameKind::VariantEnd) {
+    frame.variant_success = reader.Get<uint8_t>() != 0;
+  } else if(frame.kind == FrameKind::Call) {
+    auto& record = frame.call;
+    record.function_no = reader.Get<uint32_t>();
+    record.success = reader.Get<uint8_t>() != 0;
+    bool has_result = reader.Get<uint8_t>() != 0;
+    bool has_memory_root = reader.Get<uint8_t>() != 0;
+    auto arg_count = reader.Get<uint16_t>();
+    auto range_count = reader.Get<uint32_t>();
+    auto global_count = reader.Get<uint32_t>();
+    record.elapsed = reader.Get<int64_t>();
+    auto result = reader.Get<int64_t>();
+    record.result = has_result ? std::make_optional(result) : std::nullopt;
+    auto memory_root = reader.Get<uint64_t>();
+    record.memory_root = has_memory_root ? std::make_optional(memory_root) : std::nullopt;
+
+    record.args.clear();
+    for(uint16_t i = 0; i < arg_count && reader.ok; ++i)
+      record.args.push_back(reader.Get<int64_t>());
+
+    record.memory_diff.clear();
+    for(uint32_t i = 0; i < range_count && reader.ok; ++i) {
+      MemoryRange range;
+      range.offset = reader.Get<uint32_t>();
+      auto range_len = reader.Get<uint32_t>();
+      reader.Bytes(range.before, range_len);
+      reader.Bytes(range.after, range_len);
+      record.memory_diff.push_back(std::move(range));
+    }
+
+    record.global_diff.clear();
+    for(uint32_t i = 0; i < global_count && reader.ok; ++i) {
+      GlobalChange global;
+      global.index = reader.Get<int64_t>();
+      global.before = reader.Get<int64_t>();
+      global.after = reader.Get<int64_t>();
+      record.global_diff.push_back(global);
+    }
+  }
+
+  if(!reader.ok || reader.pos != reader.end)
+    frame.kind = FrameKind::Invalid;
+  return sizeof(len) + len;
+}
+
 void dfw::DumperLooper(std::function<dfw::FuncNameToBinFunctor> transform) {
   while(true) {
     std::string input;
@@ -168,7 +569,8 @@ void dfw::FuzzerRunnerBase::Looper() {
     else if(input == "dump") {
       // Get function name from next token
       std::cin >> input;
-      if(auto func_dump = DumpFunction(input); !func_dump) {
+      auto handle = FindFunction(input);
+      if(auto func_dump = handle ? DumpFunction(*handle) : std::nullopt; !func_dump) {
         std::cout << "Unknown function: " << input << std::endl;
       } else {
         std::cout << "Dumping function: " << input << std::endl;
@@ -178,7 +580,8 @@ void dfw::FuzzerRunnerBase::Looper() {
       std::string filename;
       std::cin >> input;
       std::cin >> filename;
-      if(auto func_dump = DumpFunction(input); !func_dump) {
+      auto handle = FindFunction(input);
+      if(auto func_dump = handle ? DumpFunction(*handle) : std::nullopt; !func_dump) {
         std::cout << "Unknown function: " << input << std::endl;
       } else {
         std::cout << "Dumping function: " << input << " to file: " << filename << std::endl;
@@ -258,7 +661,7 @@ void dfw::FuzzerRunnerBase::Looper() {
         }
         
         std::cout << "Invoke function: " << input << std::endl;
-        auto [res, elapsed] = InvokeFunction(selected_func->function_name, args);
+        auto [res, elapsed] = InvokeFunction(selected_func - functions.begin(), args);
         
         if(res != std::nullopt) {
           PrintJSValue(res.value());
@@ -369,12 +772,122 @@ void dfw::FuzzerRunnerBase::Looper() {
   }
 }
 
-std::vector<uint8_t> dfw::FuzzerRunnerBase::LoadMemory(char const* memfile) {
-  auto mem_input = dfw::OpenInput(memfile);
-  MarshallMemoryImport(mem_input.data(), mem_input.size());
+std::optional<dfw::MappedFile> dfw::FuzzerRunnerBase::LoadMemory(char const* memfile) {
+  auto mem_input = MappedFile::Open(memfile);
+  if(mem_input.has_value())
+    MarshallMemoryImport(mem_input->Data(), mem_input->Size());
   return mem_input;
 }
 
+namespace {
+  // Reads the wasm binary encoding, every read fails once past the end
+  class WasmReader {
+    std::span<uint8_t const> data;
+    size_t pos { 0 };
+  public:
+    WasmReader(std::span<uint8_t const> data) : data(data) { }
+
+    bool AtEnd() const { return pos >= data.size(); }
+
+    std::optional<uint8_t> Byte() {
+      if(pos >= data.size())
+        return std::nullopt;
+      return data[pos++];
+    }
+
+    std::optional<uint32_t> U32() {
+      uint64_t ret = 0;
+      for(int shift = 0; shift < 35; shift += 7) {
+        auto byte = Byte();
+        if(!byte.has_value())
+          return std::nullopt;
+        ret |= (uint64_t)(*byte & 0x7f) << shift;
+        if((*byte & 0x80) == 0)
+          return ret <= UINT32_MAX ? std::make_optional((uint32_t)ret) : std::nullopt;
+      }
+      return std::nullopt;
+    }
+
+    std::optional<int32_t> S32() {
+      int64_t ret = 0;
+      int shift = 0;
+      std::optional<uint8_t> byte;
+      do {
+        byte = Byte();
+        if(!byte.has_value() || shift >= 35)
+          return std::nullopt;
+        ret |= (int64_t)(*byte & 0x7f) << shift;
+        shift += 7;
+      } while(*byte & 0x80);
+      if(*byte & 0x40)
+        ret |= -((int64_t)1 << shift); // Sign extend
+      return (int32_t)ret;
+    }
+
+    std::optional<std::span<uint8_t const>> Bytes(size_t len) {
+      if(len > data.size() - pos)
+        return std::nullopt;
+      auto ret = data.subspan(pos, len);
+      pos += len;
+      return ret;
+    }
+  };
+
+  bool ParseDataSection(WasmReader reader, std::vector<dfw::DataSegment>& segments) {
+    auto count = reader.U32();
+    if(!count.has_value())
+      return false;
+    for(uint32_t i = 0; i < *count; i++) {
+      auto flags = reader.U32();
+      if(!flags.has_value() || *flags > 2)
+        return false;
+
+      // Only the first memory exists, passive segments are not copied on instantiation
+      bool active = *flags != 1;
+      if(*flags == 2 && reader.U32() != 0u)
+        return false;
+      std::optional<int32_t> offset;
+      if(active) {
+        if(reader.Byte() != 0x41) // i32.const
+          return false;
+        offset = reader.S32();
+        if(!offset.has_value() || reader.Byte() != 0x0b) // end
+          return false;
+      }
+
+      auto len = reader.U32();
+      auto bytes = len.has_value() ? reader.Bytes(*len) : std::nullopt;
+      if(!bytes.has_value())
+        return false;
+      if(active)
+        segments.push_back(dfw::DataSegment { (uint32_t)*offset, { bytes->begin(), bytes->end() } });
+    }
+    return true;
+  }
+}
+
+std::optional<std::vector<dfw::DataSegment>> dfw::ParseDataSegments(std::span<uint8_t const> module) {
+  static uint8_t const header[] = { 0x00, 'a', 's', 'm', 0x01, 0x00, 0x00, 0x00 };
+  if(module.size() < sizeof(header) || !std::equal(std::begin(header), std::end(header), module.begin()))
+    return std::nullopt;
+
+  std::vector<DataSegment> segments;
+  WasmReader reader { module.subspan(sizeof(header)) };
+  while(!reader.AtEnd()) {
+    auto id = reader.Byte();
+    auto size = reader.U32();
+    auto payload = size.has_value() ? reader.Bytes(*size) : std::nullopt;
+    if(!payload.has_value())
+      return std::nullopt;
+
+    if(*id == 8) // Start function
+      return std::nullopt;
+    if(*id == 11 && !ParseDataSection(WasmReader { *payload }, segments))
+      return std::nullopt;
+  }
+  return segments;
+}
+
 dfw::JSValue GetRandomValue(dfw::WasmType type, dfw::RandomGenerator& random) {
   using namespace dfw;
   JSValue ret;
@@ -409,24 +922,140 @@ namespace {
 
 extern "C" void HookIteration(int cnt) { ctr = cnt; }
 
+namespace {
+  // Pass the log output to the callback, which is the result ring or the
+  // common file descriptor if opened by the caller, or stdout otherwise
+  template<typename F>
+  bool WithCommonOutput(F&& callback) {
+    // The result ring replaces the pipe, which then only signals the end of the log
+    if(fcntl(RING_MEMORY_FILE_DESCRIPTOR, F_GETFD) >= 0) {
+      auto ring = dfw::ResultRing::Attach(fcntl(RING_MEMORY_FILE_DESCRIPTOR, F_DUPFD_CLOEXEC, 0),
+                                          fcntl(RING_EVENT_FILE_DESCRIPTOR, F_DUPFD_CLOEXEC, 0));
+      if(ring.has_value()) {
+        dfw::ResultRingBuf ringbuf_out(*ring);
+        std::ostream os(&ringbuf_out);
+        return callback(os);
+      }
+    }
+
+    auto flag = fcntl(COMMON_FILE_DESCRIPTOR, F_GETFD);
+    if(flag < 0)
+      return callback(std::cout);
+
+    __gnu_cxx::stdio_filebuf<char> filebuf_out(COMMON_FILE_DESCRIPTOR, std::ios::out);
+    std::ostream os(&filebuf_out);
+    return callback(os);
+  }
+}
+
 bool dfw::FuzzerRunnerBase::SingleRun(int64_t arg_seed, int iter_count, char const* memory_file, bool wait_debug) {
-  using namespace rapidjson;
+  return WithCommonOutput([&] (std::ostream& output) {
+    return SingleRun(output, arg_seed, iter_count, memory_file, wait_debug);
+  });
+}
+
+bool dfw::FuzzerRunnerBase::MultiRun(char const* module_file, std::vector<RunnerVariant> const& variants, int iter_count) {
+  // The module is compiled once by the caller and instantiated with the memory
+  // import of the first image. Following variants restore the state of that
+  // instance and swap in their image if the data segments can be replayed.
+  InstanceState state;
+  if(auto module = MappedFile::Open(module_file); module.has_value())
+    state.segments = ParseDataSegments(module->Bytes());
 
-  auto flag = fcntl(COMMON_FILE_DESCRIPTOR, F_GETFD);
+  return WithCommonOutput([&] (std::ostream& output) {
+    bool all_success = true;
+    for(size_t i = 0; i < variants.size(); i++) {
+      auto& variant = variants[i];
+      bool res = SingleRun(output, variant.arg_seed, iter_count, 
+                           variant.memory.empty() ? nullptr : variant.memory.c_str(), false, &state);
+      if(protocol == ResultProtocol::Binary) {
+        std::string frame;
+        EncodeVariantEnd(frame, res, run_digest);
+        output.write(frame.data(), frame.size());
+      } else {
+        output << "\n" << VARIANT_END_MARKER << " " << (res ? 1 : 0) << "\n";
+      }
+      output.flush();
+      all_success &= res;
+    }
+    return all_success;
+  });
+}
+
+bool dfw::FuzzerRunnerBase::SnapshotState(InstanceState& state) {
+  state.memory_address = GetWasmMemoryAddress();
+  auto memory_begin = (uint8_t const*)state.memory_address;
+  state.memory.assign(memory_begin, memory_begin + GetWasmMemorySize());
+
+  state.globals.resize(Globals().size());
+  ReadAllGlobals(state.globals);
+  state.dirty.clear();
+  state.tail_dirty = false;
+  return true;
+}
+
+bool dfw::FuzzerRunnerBase::RestoreState(InstanceState& state) {
+  if(GetWasmMemoryAddress() != state.memory_address || GetWasmMemorySize() != state.memory.size())
+    return false;
 
-  std::ostream* output = &std::cout;
-  __gnu_cxx::stdio_filebuf<char> filebuf_out(COMMON_FILE_DESCRIPTOR, std::ios::out);
-  std::ostream os(&filebuf_out);
+  // Only the spans the calls wrote to differ from the snapshot
+  auto memory_begin = (uint8_t*)state.memory_address;
+  for(auto [begin, end] : state.dirty)
+    std::memcpy(memory_begin + begin, state.memory.data() + begin, end - begin);
+  state.dirty.clear();
+  if(state.tail_dirty && state.image_size < state.memory.size())
+    std::memcpy(memory_begin + state.image_size, state.memory.data() + state.image_size, 
+                state.memory.size() - state.image_size);
+  state.tail_dirty = false;
 
-  if(flag >= 0) {
-    output = &os;
+  WriteAllGlobals(state.globals);
+  return true;
+}
+
+bool dfw::FuzzerRunnerBase::SwapImage(InstanceState& state, char const* memory_file, std::span<uint8_t const> image) {
+  // RestoreState already brought back every byte written since the snapshot
+  if(state.image == memory_file)
+    return true;
+  if(!state.segments.has_value() || image.size() != state.image_size || image.size() > state.memory.size())
+    return false;
+
+  // The memory beyond the image is the same for every image of the size
+  std::memcpy(state.memory.data(), image.data(), image.size());
+  for(auto& segment : *state.segments) {
+    // Segments beyond the image are part of the unchanged tail
+    if(segment.offset >= image.size())
+      continue;
+    size_t len = std::min(segment.bytes.size(), image.size() - segment.offset);
+    std::memcpy(state.memory.data() + segment.offset, segment.bytes.data(), len);
   }
+  std::memcpy((uint8_t*)state.memory_address, state.memory.data(), image.size());
+  state.image = memory_file;
+  return true;
+}
+
+bool dfw::FuzzerRunnerBase::SingleRun(std::ostream& output_stream, int64_t arg_seed, int iter_count, char const* memory_file, 
+                                      bool wait_debug, InstanceState* reuse) {
+  using namespace rapidjson;
+
+  std::ostream* output = &output_stream;
   
-  std::optional<std::vector<uint8_t>> memory;
+  // An instance is only reused with a memory image
+  if(reuse != nullptr && memory_file == nullptr)
+    reuse = nullptr;
+  bool restored = reuse != nullptr && reuse->valid && RestoreState(*reuse);
+
+  // A private mapping of the file is the baseline of the memory diffs, it is
+  // brought to the state of the instance before the first call
+  std::optional<MappedFile> memory;
   std::cout << "Load memory: " << memory_file << std::endl;
-  if(memory_file != nullptr) {
-    memory.emplace(LoadMemory(memory_file));
+  if(restored) {
+    memory = MappedFile::Open(memory_file);
+    restored = memory.has_value() && SwapImage(*reuse, memory_file, memory->Bytes());
   }
+  if(!restored && memory_file != nullptr) {
+    memory = LoadMemory(memory_file);
+  }
+  RETURN_IF_FALSE(memory_file == nullptr || memory.has_value());
 
   std::cout << "Memory Address: 0x" << std::hex << GetWasmMemoryAddress() << std::dec << std::endl;
 
@@ -437,123 +1066,240 @@ bool dfw::FuzzerRunnerBase::SingleRun(int64_t arg_seed, int iter_count, char con
   }
 
   //std::cout << "Initialize execution" << std::endl;
-  RETURN_IF_FALSE(InitializeExecution());
+  run_digest = 0;
+  if(!restored) {
+    if(reuse != nullptr)
+      reuse->valid = false;
+    RETURN_IF_FALSE(InitializeExecution());
+    if(reuse != nullptr) {
+      reuse->valid = SnapshotState(*reuse);
+      reuse->image = memory_file;
+      reuse->image_size = memory->Size();
+    }
+  }
 
   // Loop function call, cover all possible functions
   //std::cout << "Get functions" << std::endl;
   RandomGenerator random { arg_seed };
-  auto funcs = Functions();
+  auto& funcs = Functions();
   size_t func_count = funcs.size();
   //std::cout << "Start Looping\n" << std::endl;
-  std::sort(funcs.begin(), funcs.end(), 
-            [] (dfw::FunctionInfo const& a, dfw::FunctionInfo const& b) {
-              return a.function_name > b.function_name;
+  // The functions are selected in descending order of their names, the batch
+  // refers to them by their index in Functions()
+  std::vector<uint32_t> order(func_count);
+  for(size_t f = 0; f < func_count; f++)
+    order[f] = f;
+  std::sort(order.begin(), order.end(), 
+            [&funcs] (uint32_t a, uint32_t b) {
+              return funcs[a].function_name > funcs[b].function_name;
             });
 
-  *output << "[";
-
   // Initialize Global Values
   auto globals = Globals();
-  std::map<std::string, JSValue> global_state;
+  std::vector<JSValue> global_state;
+  std::vector<int64_t> global_numbers;
   for(auto& global : globals) {
-    auto init_val = GetRandomValue(global.type, random);
-    SetGlobal(global.global_name, init_val);
-    global_state.emplace(global.global_name, init_val);
+    global_state.push_back(GetRandomValue(global.type, random));
+    global_numbers.push_back(std::strtol(&global.global_name[6], nullptr, 10));
+  }
+  WriteAllGlobals(global_state);
+  std::vector<JSValue> global_values(globals.size());
+
+  // The diffs start from the memory after the instantiation, which applied the
+  // data segments to the image, so the tracked and the full comparison report
+  // the same changes
+  std::optional<PageHashTree> page_hashes;
+  if(memory.has_value()) {
+    std::memcpy(memory->Data(), (uint8_t const*)GetWasmMemoryAddress(), std::min(memory->Size(), GetWasmMemorySize()));
+    page_hashes.emplace(memory->Bytes());
   }
 
-  for(int i = 0; i < iter_count; ++i) {
+  // Function number of the function names
+  std::vector<int64_t> func_numbers;
+  for(auto& func : funcs)
+    func_numbers.push_back(std::strtol(&func.function_name[4], nullptr, 10));
+
+  // Draw the calls up front, the random numbers are consumed in the same
+  // order as when every call was drawn right before it was invoked
+  size_t call_count = std::max(iter_count, 0);
+  std::vector<BatchCall> calls(call_count);
+  std::vector<uint64_t> call_args;
+  for(auto& call : calls) {
+    call.function = order[random.get<uint16_t>() % func_count];
+    call.first_arg = call_args.size();
+    GenerateArgs(funcs[call.function].parameters, random, call_args);
+  }
+  std::vector<BatchResult> results(call_count);
+
+  // Only the pages written by the call are compared if they are tracked
+  uintptr_t memory_address = 0;
+  bool tracked = false;
+  auto arm = [&] (size_t i) {
     HookIteration(i);
-    // Prepare JSON Logging
-    Document report;
-    auto& reportArr = report.SetObject();
-    Document::AllocatorType& allocator = report.GetAllocator();
-
-    // Select the function
-    size_t select_func = random.get<uint16_t>() % func_count;
-    auto& the_func = funcs[select_func];
-    auto args = GenerateArgs(the_func.parameters, random);
-
-    // Log the execution
-    reportArr.AddMember(Value("FunctionName"),
-                        Value(the_func.function_name.c_str(), allocator).Move(),
-                        allocator);
-    Value argArray(kArrayType);
-    for(auto& arg : args) {
-      argArray.PushBack(Value(StringBinRepresentation(arg).c_str(), allocator).Move(), allocator);
+    if(memory.has_value() && dirty_tracker.has_value()) {
+      memory_address = GetWasmMemoryAddress();
+      tracked = dirty_tracker->Arm((uint8_t*)memory_address, GetWasmMemorySize());
     }
-    reportArr.AddMember(Value("Args"), argArray.Move(), allocator);
+  };
 
-    // Invoke
-    auto [res, elapsed] = InvokeFunction(the_func.function_name, args);
-    
-    
-    reportArr.AddMember(Value("Elapsed"),
-                        Value(std::to_string(elapsed).c_str(), allocator).Move(), 
-                        allocator);
+  auto after_call = [&] (size_t i) {
+    auto& call = calls[i];
+    auto& the_func = funcs[call.function];
+    auto& res = results[i];
+    CallRecord record;
 
-    if(res.has_value()) {
-      reportArr.AddMember(Value("Success"), Value(true), allocator);
-      if(res->type != WasmType::Void)
-        reportArr.AddMember(Value("Result"),
-                            Value(StringBinRepresentation(*res).c_str(), allocator).Move(), 
-                            allocator);
-    } else {
-      reportArr.AddMember(Value("Success"), Value(false), allocator);
-    }
+    record.function_no = func_numbers[call.function];
+    for(size_t p = 0; p < the_func.parameters.size(); p++)
+      record.args.push_back(BinRepresentation(UnpackArg(the_func.parameters[p], call_args[call.first_arg + p])));
+
+    record.elapsed = res.elapsed;
+    record.success = res.success;
+    if(res.success && res.result.type != WasmType::Void)
+      record.result = BinRepresentation(res.result);
 
     if(memory.has_value()) {
-      auto comparison = this->CompareInternalMemory(*memory);
-      if(!comparison.empty()) {
-        Value memDiff(kObjectType);
-        for(auto& diff : comparison) {
-          Value thisDiff(kArrayType);
-          thisDiff.PushBack(Value(diff.old_byte), allocator);
-          thisDiff.PushBack(Value(diff.new_byte), allocator);
-          memDiff.AddMember(Value(std::to_string(diff.index).c_str(), allocator).Move(), thisDiff.Move(), allocator);
-        }
-        reportArr.AddMember(Value("MemoryDiff"), memDiff.Move(), allocator);
+      // A grown memory may have moved, the old pages tell nothing then
+      bool collected = tracked && dirty_tracker->Collect(dirty_spans) && GetWasmMemoryAddress() == memory_address;
+      if(collected)
+        record.memory_diff = DiffMemory(memory->Bytes(), (uint8_t const*)memory_address, GetWasmMemorySize(), dirty_spans);
+      else
+        record.memory_diff = this->CompareInternalMemory(memory->Bytes());
+      page_hashes->Update(memory->Bytes(), record.memory_diff);
+      record.memory_root = page_hashes->Root();
+
+      // The written pages are restored if they are known. Otherwise the
+      // diffs, which start from the snapshot, and the memory beyond the image
+      // the diffs do not cover.
+      if(reuse != nullptr && collected) {
+        reuse->dirty.insert(reuse->dirty.end(), dirty_spans.begin(), dirty_spans.end());
+      } else if(reuse != nullptr) {
+        for(auto& range : record.memory_diff)
+          reuse->dirty.emplace_back(range.offset, range.offset + range.after.size());
+        reuse->tail_dirty = true;
       }
     }
     
     // Do comparison globals
-    Value globalDiff(kObjectType);
-    int global_diff_ctr = 0;
-    for(auto& global : global_state) {
-      auto new_state = GetGlobal(global.first);
-      if(new_state != global.second) {
-        Value thisDiff(kArrayType);
-        thisDiff.PushBack(Value(StringBinRepresentation(global.second).c_str(), allocator).Move(), allocator);
-        thisDiff.PushBack(Value(StringBinRepresentation(new_state).c_str(), allocator).Move(), allocator);
-        globalDiff.AddMember(Value(&global.first[6], allocator).Move(), thisDiff.Move(), allocator);
-        global_diff_ctr++;
-          
-        global.second = new_state;
+    ReadAllGlobals(global_values);
+    for(size_t g = 0; g < global_state.size(); g++) {
+      if(global_values[g] != global_state[g]) {
+        record.global_diff.push_back(GlobalChange { 
+          global_numbers[g],
+          BinRepresentation(global_state[g]),
+          BinRepresentation(global_values[g])
+        });
+        global_state[g] = global_values[g];
       }
     }
-    if(global_diff_ctr != 0) {
-      reportArr.AddMember(Value("GlobalDiff"), globalDiff.Move(), allocator);
-    }
 
-    if(i != 0) *output << ",";
-    OStreamWrapper osw(*output);
-    Writer<OStreamWrapper> writer(osw);
-    report.Accept(writer);
+    WriteRecord(*output, call.function, record);
+
+    if(i + 1 < call_count)
+      arm(i + 1);
+  };
+
+  if(call_count != 0) {
+    arm(0);
+    InvokeBatch(calls.data(), call_count, call_args.data(), results.data(), after_call);
   }
-  *output << "]";
 
   return true;
 }
 
+std::optional<dfw::FunctionHandle> dfw::FuzzerRunnerBase::FindFunction(std::string const& name) {
+  auto& funcs = Functions();
+  for(FunctionHandle f = 0; f < funcs.size(); f++) {
+    if(funcs[f].function_name == name)
+      return f;
+  }
+  return std::nullopt;
+}
+
+void dfw::FuzzerRunnerBase::WriteRecord(std::ostream& output, FunctionHandle function, CallRecord const& record) {
+  using namespace rapidjson;
+
+  uint64_t digest = DigestCallRecord(record);
+  run_digest = RollDigest(run_digest, digest);
+
+  if(protocol == ResultProtocol::Binary) {
+    std::string frame;
+    EncodeCallRecord(frame, record, digest);
+    output.write(frame.data(), frame.size());
+    output.flush();
+    return;
+  }
+
+  // Prepare JSON Logging
+  Document report;
+  auto& reportArr = report.SetObject();
+  Document::AllocatorType& allocator = report.GetAllocator();
+
+  reportArr.AddMember(Value("FunctionName"),
+                      Value(Functions()[function].function_name.c_str(), allocator).Move(),
+                      allocator);
+  Value argArray(kArrayType);
+  for(auto arg : record.args) {
+    argArray.PushBack(Value(std::to_string(arg).c_str(), allocator).Move(), allocator);
+  }
+  reportArr.AddMember(Value("Args"), argArray.Move(), allocator);
+
+  reportArr.AddMember(Value("Elapsed"),
+                      Value(std::to_string(record.elapsed).c_str(), allocator).Move(), 
+                      allocator);
+
+  reportArr.AddMember(Value("Success"), Value(record.success), allocator);
+  if(record.result.has_value())
+    reportArr.AddMember(Value("Result"),
+                        Value(std::to_string(*record.result).c_str(), allocator).Move(), 
+                        allocator);
+
+  if(!record.memory_diff.empty()) {
+    Value memDiff(kObjectType);
+    for(auto& range : record.memory_diff) {
+      for(size_t j = 0; j < range.after.size(); ++j) {
+        Value thisDiff(kArrayType);
+        thisDiff.PushBack(Value(range.before[j]), allocator);
+        thisDiff.PushBack(Value(range.after[j]), allocator);
+        memDiff.AddMember(Value(std::to_string(range.offset + j).c_str(), allocator).Move(), thisDiff.Move(), allocator);
+      }
+    }
+    reportArr.AddMember(Value("MemoryDiff"), memDiff.Move(), allocator);
+  }
+
+  if(record.memory_root.has_value())
+    reportArr.AddMember(Value("MemoryRoot"),
+                        Value(std::to_string(*record.memory_root).c_str(), allocator).Move(), 
+                        allocator);
+
+  if(!record.global_diff.empty()) {
+    Value globalDiff(kObjectType);
+    for(auto& global : record.global_diff) {
+      Value thisDiff(kArrayType);
+      thisDiff.PushBack(Value(std::to_string(global.before).c_str(), allocator).Move(), allocator);
+      thisDiff.PushBack(Value(std::to_string(global.after).c_str(), allocator).Move(), allocator);
+      globalDiff.AddMember(Value(std::to_string(global.index).c_str(), allocator).Move(), thisDiff.Move(), allocator);
+    }
+    reportArr.AddMember(Value("GlobalDiff"), globalDiff.Move(), allocator);
+  }
+
+  // One record per line, flushed so the coordinator can compare it right away
+  OStreamWrapper osw(output);
+  Writer<OStreamWrapper> writer(osw);
+  report.Accept(writer);
+  output << "\n";
+  output.flush();
+}
+
 bool dfw::FuzzerRunnerBase::InvokeFunction(dfw::FuzzerRunnerCLArgs const& args) {
   if(!args.function.set) {
     std::cerr << "Set the function name through -function args\n";
     return false;
   }
 
-  std::optional<std::vector<uint8_t>> memory;
+  std::optional<MappedFile> memory;
   std::cout << "Load memory" << std::endl;
   if(args.memory.set) {
-    memory.emplace(LoadMemory(args.memory.value));
+    memory = LoadMemory(args.memory.value);
   }
   std::cout << "Initialize execution" << std::endl;
   RETURN_IF_FALSE(InitializeExecution());
@@ -580,7 +1326,7 @@ bool dfw::FuzzerRunnerBase::InvokeFunction(dfw::FuzzerRunnerCLArgs const& args)
             << selectedFunc->function_name << " " 
             << selectedFunc->parameters.size() << std::endl;
   std::cout.flush();
-  auto [res, elapsed] = InvokeFunction(selectedFunc->function_name, 
+  auto [res, elapsed] = InvokeFunction(selectedFunc - funcs.begin(), 
                                        GenerateArgs(selectedFunc->parameters, random));
   
   if(res.has_value()) {
@@ -623,21 +1369,187 @@ std::vector<dfw::JSValue> dfw::FuzzerRunnerBase::GenerateArgs(std::vector<WasmTy
   return args;
 }
 
+void dfw::FuzzerRunnerBase::GenerateArgs(std::vector<WasmType> const& param_types, RandomGenerator& random, 
+                                         std::vector<uint64_t>& packed) {
+  for(auto param_type : param_types) {
+    switch (param_type)
+    {
+    case WasmType::I32:
+    case WasmType::F32:
+      packed.push_back(random.get<uint32_t>());
+      break;
+    case WasmType::I64:
+    case WasmType::F64:
+      packed.push_back(random.get<uint64_t>());
+      break;
+    default:
+      std::cerr << "Unexpected param_type when generating arguments\n";
+      std::abort();
+    }
+  }
+}
+
+namespace {
+  // Resident set size of this process in MiB
+  int64_t ResidentSetSize() {
+    std::ifstream statm("/proc/self/statm");
+    int64_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+  }
+}
+
+bool dfw::FuzzerRunnerBase::RunJob(dfw::FuzzerRunnerCLArgs const& args, RunnerJob const& job) {
+  dfw::FuzzerRunnerCLArgs job_args = args;
+  job_args.input.value = job.input.c_str();
+  job_args.input.set = true;
+
+  return InitializeModule(job_args) && MultiRun(job.input.c_str(), job.variants, job.iter_count);
+}
+
+namespace {
+  // The result pipe and optionally the result ring of a job, in the order
+  // they are sent by the coordinator
+  std::vector<std::pair<int, int>> JobFileDescriptors(std::vector<int> const& fds) {
+    if(fds.size() != 1 && fds.size() != 3)
+      return {};
+
+    int const targets[] = { COMMON_FILE_DESCRIPTOR, 
+                            RING_MEMORY_FILE_DESCRIPTOR, 
+                            RING_EVENT_FILE_DESCRIPTOR };
+    std::vector<std::pair<int, int>> ret;
+    for(size_t i = 0; i < fds.size(); i++)
+      ret.emplace_back(fds[i], targets[i]);
+    return ret;
+  }
+}
+
+int dfw::FuzzerRunnerBase::ForkServer(dfw::FuzzerRunnerCLArgs const& args) {
+  // The engine is already initialized by the caller. Each job received on the
+  // control channel is executed in a forked child which inherits the warm engine,
+  // so the cost of starting the engine is only paid once.
+  while(true) {
+    std::vector<int> fds;
+    auto msg = ReceiveControlMessage(CONTROL_FILE_DESCRIPTOR, &fds);
+    if(!msg.has_value())
+      break; // Coordinator closed the channel
+
+    auto job = RunnerJob::Parse(*msg);
+    auto job_fds = JobFileDescriptors(fds);
+    if(!job.has_value() || job_fds.empty()) {
+      for(int fd : fds) close(fd);
+      SendControlMessage(CONTROL_FILE_DESCRIPTOR, "error");
+      continue;
+    }
+
+    pid_t pid = fork();
+    if(pid == 0) {
+      // Child process
+      close(CONTROL_FILE_DESCRIPTOR);
+      InstallFileDescriptors(job_fds);
+
+      bool res = RunJob(args, *job);
+      
+      // Skip the destructors of the engine which belongs to the server
+      std::cout.flush();
+      _exit(res ? 0 : 1);
+    }
+
+    for(int fd : fds) close(fd);
+    if(pid < 0) {
+      SendControlMessage(CONTROL_FILE_DESCRIPTOR, "error");
+      continue;
+    }
+
+    SendControlMessage(CONTROL_FILE_DESCRIPTOR, dfw::strjoin("pid ", std::to_string(pid)));
+
+    int status = 0;
+    while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+    SendControlMessage(CONTROL_FILE_DESCRIPTOR, 
+                       dfw::strjoin("exit ", std::to_string(pid), " ", std::to_string(status)));
+  }
+  return 0;
+}
+
+int dfw::FuzzerRunnerBase::Persistent(dfw::FuzzerRunnerCLArgs const& args) {
+  // Same protocol as the fork server, but every job runs in this process on
+  // the same engine instance. The process retires itself after -max-jobs jobs
+  // or once it grows past -max-rss MiB, and the coordinator starts a new one.
+  int64_t job_count = 0;
+  while(true) {
+    std::vector<int> fds;
+    auto msg = ReceiveControlMessage(CONTROL_FILE_DESCRIPTOR, &fds);
+    if(!msg.has_value())
+      break; // Coordinator closed the channel
+
+    auto job = RunnerJob::Parse(*msg);
+    auto job_fds = JobFileDescriptors(fds);
+    if(!job.has_value() || job_fds.empty()) {
+      for(int fd : fds) close(fd);
+      SendControlMessage(CONTROL_FILE_DESCRIPTOR, "error");
+      continue;
+    }
+
+    SendControlMessage(CONTROL_FILE_DESCRIPTOR, dfw::strjoin("pid ", std::to_string(getpid())));
+
+    InstallFileDescriptors(job_fds);
+
+    bool res = RunIsolated([&] { return RunJob(args, *job); });
+    TeardownModule();
+
+    // Signal the end of the log to the coordinator
+    for(auto [source, target] : job_fds)
+      close(target);
+
+    int status = res ? 0 : W_EXITCODE(1, 0);
+    SendControlMessage(CONTROL_FILE_DESCRIPTOR, 
+                       dfw::strjoin("exit ", std::to_string(getpid()), " ", std::to_string(status)));
+
+    ++job_count;
+    if(args.max_jobs.value > 0 && job_count >= args.max_jobs.value)
+      break;
+    if(args.max_rss.value > 0 && ResidentSetSize() >= args.max_rss.value)
+      break;
+  }
+  return 0;
+}
+
 int dfw::FuzzerRunnerBase::Run(int argc, char const* argv[]) {
   dfw::FuzzerRunnerCLArgs args { argc, argv };
 
+  auto result_protocol = ParseResultProtocol(args.protocol);
+  ERROR_IF_FALSE(result_protocol.has_value(), "Unknown result protocol, use json or binary.");
+  protocol = *result_protocol;
+
+  auto dirty_tracking = ParseDirtyTracking(args.dirty_tracking);
+  ERROR_IF_FALSE(dirty_tracking.has_value(), "Unknown dirty tracking, use off, protect or soft-dirty.");
+  if(*dirty_tracking != DirtyTracking::Off)
+    dirty_tracker.emplace(*dirty_tracking);
+
+  if(std::strcmp(args.mode, "server") == 0)
+    return ForkServer(args);
+  else if(std::strcmp(args.mode, "persistent") == 0)
+    return Persistent(args);
+
+  ERROR_IF_FALSE(args.input.set, "Required argument is not set: -input");
   ERROR_IF_FALSE(InitializeModule(args), "Failed initializing and compiling WASM");
   
   if(std::strcmp(args.mode, "interactive") == 0) {
     Looper();
   } else if(std::strcmp(args.mode, "single") == 0) {
     ERROR_IF_FALSE(SingleRun(args.arg_seed.value, args.count.value, args.memory.set ? args.memory.value : nullptr), "Failed executing test case.");
+  } else if(std::strcmp(args.mode, "multi") == 0) {
+    ERROR_IF_FALSE(args.memories.set && args.arg_seeds.set, "Set the variants through -memories and -arg-seeds args");
+    auto variants = RunnerJob::ParseVariants(args.memories, args.arg_seeds);
+    ERROR_IF_FALSE(variants.has_value(), "Mismatched -memories and -arg-seeds list.");
+    ERROR_IF_FALSE(MultiRun(args.input, *variants, args.count.value), "Failed executing test case.");
   } else if(std::strcmp(args.mode, "invoke") == 0) {
     ERROR_IF_FALSE(InvokeFunction(args), "Failed invoking function.");
   } else if(std::strcmp(args.mode, "debug") == 0) {
     // Force compile all function and print the address
-    for(dfw::FunctionInfo const& info : Functions()) {
-      DumpFunction(info.function_name);
+    for(FunctionHandle f = 0; f < Functions().size(); f++) {
+      DumpFunction(f);
     }
     for(dfw::FunctionInfo const& info : Functions()) {
       std::cout << std::hex << "0x" << info.instruction_address << std::dec;
@@ -1,11 +1,17 @@
 #ifndef RUNNER_COMMON_H
 #define RUNNER_COMMON_H
 
+#include "dirty-tracker.h"
+#include "mapped-file.h"
+#include "random-engine.h"
+
 #include <cstdint>
 #include <functional>
 #include <optional>
 #include <ostream>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <errno.h>
 #include <string.h>
@@ -20,18 +26,42 @@
 #include <random>
 
 #define COMMON_FILE_DESCRIPTOR 3
+#define CONTROL_FILE_DESCRIPTOR 4
+// Memory images shared by the coordinator are inherited at or above this descriptor
+#define MEMORY_IMAGE_FILE_DESCRIPTOR_BASE 16
+
+// Terminates the log of every variant in the output of a runner,
+// followed by 1 if the variant executed successfully and 0 otherwise
+#define VARIANT_END_MARKER "ENDCOMPARE"
 
 namespace dfw {
 std::vector<uint8_t> OpenInput(char const *fileName);
 void DumpDisassemble(std::ostream &output,
                      std::vector<uint8_t> const &instructions);
 void WriteOutput(char const *fileName, std::vector<uint8_t> const &buf);
-std::vector<uint8_t> GenerateRandomData(uint64_t seed, uint32_t len);
+std::vector<uint8_t> GenerateRandomData(uint64_t seed, uint32_t len, RandomFill generator = RandomFill::Philox);
 
 typedef std::optional<std::vector<uint8_t>>
 FuncNameToBinFunctor(std::string const &);
 void DumperLooper(std::function<FuncNameToBinFunctor> transform);
 
+// Control channel between the coordinator and a long-lived runner. Messages
+// are sent over a SOCK_SEQPACKET socket so each one keeps its boundary, and
+// up to MAX_CONTROL_FILE_DESCRIPTORS file descriptors can be attached to it
+// (SCM_RIGHTS).
+#define MAX_CONTROL_FILE_DESCRIPTORS 3
+bool SendControlMessage(int socket, std::string const& msg, std::vector<int> const& fds = {});
+std::optional<std::string> ReceiveControlMessage(int socket, std::vector<int>* fds = nullptr);
+
+// Move each file descriptor to its target number, surviving exec. Safe when
+// a source is equal to another target.
+void InstallFileDescriptors(std::vector<std::pair<int, int>> const& source_target);
+
+// Scan the raw command line for a mode that forks after the engine is
+// initialized. Engines must then be started without helper threads, as
+// only the forking thread survives in the child.
+bool ForkSafeEngineRequired(int argc, char const* argv[]);
+
 template <typename T> bool ConsumeArg(char const *arg, T &target);
 
 template <> inline bool ConsumeArg(char const *arg, char const *&target) {
@@ -49,6 +79,11 @@ template <> inline bool ConsumeArg(char const *arg, int64_t &target) {
   return true;
 }
 
+template <> inline bool ConsumeArg(char const *arg, int &target) {
+  target = std::stoi(std::string{arg});
+  return true;
+}
+
 template <typename T> struct CommandLineArg {
   T value{};
   bool set{false};
@@ -146,12 +181,18 @@ struct CommandLineConsumer {
 };
 
 struct FuzzerRunnerCLArgs {
-  dfw::CommandLineArg<char const*> input { "-input", true };
+  dfw::CommandLineArg<char const*> input { "-input", false };
   dfw::CommandLineArg<char const*> mode { "-mode", false, "interactive" };
   dfw::CommandLineArg<char const*> memory { "-memory", false };
   dfw::CommandLineArg<char const*> function { "-function", false };
   dfw::CommandLineArg<int> count { "-invoke-count", false, 50 };
   dfw::CommandLineArg<int64_t> arg_seed { "-arg-seed", false, 0 };
+  dfw::CommandLineArg<char const*> memories { "-memories", false }; // comma separated
+  dfw::CommandLineArg<char const*> arg_seeds { "-arg-seeds", false }; // comma separated
+  dfw::CommandLineArg<int64_t> max_jobs { "-max-jobs", false, 0 };
+  dfw::CommandLineArg<int64_t> max_rss { "-max-rss", false, 0 }; // in MiB
+  dfw::CommandLineArg<char const*> protocol { "-protocol", false, "json" }; // json or binary
+  dfw::CommandLineArg<char const*> dirty_tracking { "-dirty-tracking", false, "off" }; // off, protect or soft-dirty
   char const* exec_path;
   FuzzerRunnerCLArgs(int argc, char const* argv[]) : exec_path(argv[0]) {
     dfw::CommandLineConsumer { argc, argv, 
@@ -159,10 +200,39 @@ struct FuzzerRunnerCLArgs {
                                std::ref(mode),
                                std::ref(memory),
                                std::ref(function),
-                               std::ref(arg_seed) };
+                               std::ref(count),
+                               std::ref(arg_seed),
+                               std::ref(memories),
+                               std::ref(arg_seeds),
+                               std::ref(max_jobs),
+                               std::ref(max_rss),
+                               std::ref(protocol),
+                               std::ref(dirty_tracking) };
   }
 };
 
+// One memory image and argument seed to execute a compiled module with
+struct RunnerVariant {
+  std::string memory;
+  int64_t arg_seed;
+};
+
+// Variants sharing a module, handed to a runner as one job
+struct RunnerJob {
+  std::string input;
+  std::vector<RunnerVariant> variants;
+  int iter_count;
+
+  std::string Serialize() const;
+  static std::optional<RunnerJob> Parse(std::string const& msg);
+
+  // Variants in the comma separated form of the command line
+  std::string MemoryList() const;
+  std::string ArgSeedList() const;
+  static std::optional<std::vector<RunnerVariant>> ParseVariants(char const* memories, 
+                                                                 char const* arg_seeds);
+};
+
 enum class WasmType {
   Void,
   I32,
@@ -180,6 +250,9 @@ struct FunctionInfo {
   intptr_t instruction_address;
 };
 
+// Index of a function in Functions(), stable while the module is loaded
+using FunctionHandle = uint32_t;
+
 struct GlobalInfo {
   std::string global_name;
   WasmType type;
@@ -201,6 +274,31 @@ struct JSValue {
   }
 };
 
+// One call of a batch, its arguments are args[first_arg] onwards, one per parameter
+struct BatchCall {
+  FunctionHandle function;
+  uint32_t first_arg;
+};
+
+// Outcome of a call of a batch, the result is Void if the function returned nothing
+struct BatchResult {
+  bool success;
+  JSValue result;
+  uint64_t elapsed;
+};
+
+// Arguments of a batch are packed as their raw bits, 32-bit values in the low half
+inline JSValue UnpackArg(WasmType type, uint64_t bits) {
+  JSValue value;
+  value.type = type;
+  value.i64 = 0;
+  if(type == WasmType::I32 || type == WasmType::F32)
+    value.i32 = (uint32_t)bits;
+  else
+    value.i64 = bits;
+  return value;
+}
+
 /*
 struct DataRange {
   std::vector<uint8_t> const& data;
@@ -306,30 +404,171 @@ struct MemoryDiff {
     index(index), old_byte(old_byte), new_byte(new_byte) { }
 };
 
+// Format of the log written to the common file descriptor
+enum class ResultProtocol {
+  Json,
+  Binary
+};
+
+std::optional<ResultProtocol> ParseResultProtocol(char const* name);
+
+// Consecutive bytes of the memory changed by a call
+struct MemoryRange {
+  uint32_t offset;
+  std::vector<uint8_t> before;
+  std::vector<uint8_t> after;
+
+  bool operator==(MemoryRange const&) const = default;
+};
+
+struct GlobalChange {
+  int64_t index;
+  int64_t before;
+  int64_t after;
+
+  bool operator==(GlobalChange const&) const = default;
+};
+
+// A single function call reported by a runner, values are in their binary representation
+struct CallRecord {
+  int64_t function_no;
+  std::vector<int64_t> args;
+  int64_t elapsed;
+  bool success;
+  std::optional<int64_t> result;
+  std::vector<MemoryRange> memory_diff;
+  std::vector<GlobalChange> global_diff;
+  std::optional<uint64_t> memory_root; // Root of the page hashes after the call
+};
+
+std::vector<MemoryRange> PackMemoryDiff(std::vector<MemoryDiff> const& diff);
+
+// Digest of the content of a call record without the elapsed time, so both
+// engines yield the same digest for the same behaviour
+uint64_t DigestCallRecord(CallRecord const& record);
+
+// Digest of a whole run, rolled over the digests of its calls
+inline uint64_t RollDigest(uint64_t rolling, uint64_t call_digest) {
+  return (rolling ^ call_digest) * 0x100000001B3ull + (rolling >> 29);
+}
+
+// Binary frames are a 32-bit length of the rest of the frame, the kind, the
+// 64-bit digest of the call or of the variant, and the payload
+enum class FrameKind : uint8_t {
+  Invalid = 0,
+  Call = 'C',
+  VariantEnd = 'E'
+};
+
+struct RecordFrame {
+  FrameKind kind;
+  uint64_t digest;
+  bool variant_success;
+  CallRecord call;
+};
+
+void EncodeCallRecord(std::string& out, CallRecord const& record, uint64_t digest);
+void EncodeVariantEnd(std::string& out, bool success, uint64_t digest);
+
+// Read the kind and the digest of the frame at the beginning of the buffer
+// without decoding its payload. Returns the size of the frame like DecodeFrame.
+size_t PeekFrame(std::string_view buffer, FrameKind& kind, uint64_t& digest);
+
+// Decode the frame at the beginning of the buffer. Returns the size of the frame,
+// or 0 if the buffer does not hold a complete frame yet. The kind of a malformed
+// frame is Invalid.
+size_t DecodeFrame(std::string_view buffer, RecordFrame& frame);
+
 
 
 void PrintJSValue(JSValue const& v);
 
+// Active data segment of a module, copied into the memory on instantiation
+struct DataSegment {
+  uint32_t offset;
+  std::vector<uint8_t> bytes;
+};
+
+// The data segments written into the memory when the module is instantiated.
+// Unset if the instantiation may write anything else to the memory, i.e. the
+// module has a start function or a segment offset that is not a constant.
+std::optional<std::vector<DataSegment>> ParseDataSegments(std::span<uint8_t const> module);
+
+// State of an instance right after it was instantiated with a memory image,
+// so the next variant can start from it without instantiating the module
+// again, also with another image of the same size
+struct InstanceState {
+  bool valid { false };
+  std::vector<uint8_t> memory;
+  uintptr_t memory_address { 0 };
+  std::vector<JSValue> globals; // In the order of Globals()
+  std::vector<std::pair<size_t, size_t>> dirty; // Memory spans written since the snapshot
+  bool tail_dirty { false }; // The memory beyond the image was written to, untracked
+  std::string image; // Memory image of the snapshot
+  size_t image_size { 0 };
+  std::optional<std::vector<DataSegment>> segments; // Replayed when the image is swapped
+};
+
 class FuzzerRunnerBase {
 public:
   void Looper();
-  std::vector<uint8_t> LoadMemory(char const* memfile);
+  // Map the memory file and copy it into the memory import, the mapping is the
+  // baseline of the memory diffs
+  std::optional<MappedFile> LoadMemory(char const* memfile);
   std::vector<dfw::JSValue> GenerateArgs(std::vector<WasmType> const& param_types, RandomGenerator& random);
+  // Like GenerateArgs, appending the packed arguments of a batch call
+  void GenerateArgs(std::vector<WasmType> const& param_types, RandomGenerator& random, std::vector<uint64_t>& packed);
   bool SingleRun(int64_t arg_seed, int iter_count, char const* memory_file, bool wait_debug = false);
+  bool SingleRun(std::ostream& output, int64_t arg_seed, int iter_count, char const* memory_file, 
+                 bool wait_debug = false, InstanceState* reuse = nullptr);
+  bool MultiRun(char const* module_file, std::vector<RunnerVariant> const& variants, int iter_count);
   bool InvokeFunction(dfw::FuzzerRunnerCLArgs const& args);
+  bool RunJob(dfw::FuzzerRunnerCLArgs const& args, RunnerJob const& job);
+  int ForkServer(dfw::FuzzerRunnerCLArgs const& args);
+  int Persistent(dfw::FuzzerRunnerCLArgs const& args);
   int Run(int argc, char const* argv[]);
-
+  void WriteRecord(std::ostream& output, FunctionHandle function, CallRecord const& record);
+  // Look a function up by its name, only meant for the interactive modes
+  std::optional<FunctionHandle> FindFunction(std::string const& name);
+
+  // Capture the memory and the globals of the instance. Tables are not
+  // accessible through the engine APIs and are not part of the state.
+  virtual bool SnapshotState(InstanceState& state);
+  // Write back the written memory spans and the globals. False if the memory
+  // grew or moved since the snapshot, the module must be instantiated again.
+  virtual bool RestoreState(InstanceState& state);
+  // Replace the image of the restored instance by another one of the same
+  // size, as if the module was instantiated with it. False if not possible.
+  bool SwapImage(InstanceState& state, char const* memory_file, std::span<uint8_t const> image);
+
+  ResultProtocol protocol { ResultProtocol::Json };
+  uint64_t run_digest { 0 }; // Rolling digest of the calls of the current run
+  std::optional<DirtyTracker> dirty_tracker; // Set unless the whole memory is compared
+  std::vector<std::pair<size_t, size_t>> dirty_spans;
+
+  // The reflection data is built once after InitializeModule
   virtual std::vector<FunctionInfo> const& Functions() = 0;
-  virtual std::optional<std::vector<uint8_t>> DumpFunction(std::string const&) = 0;
-  virtual std::tuple<std::optional<dfw::JSValue>, uint64_t> InvokeFunction(std::string const&, std::vector<JSValue> const&) = 0;
+  virtual std::optional<std::vector<uint8_t>> DumpFunction(FunctionHandle) = 0;
+  virtual std::tuple<std::optional<dfw::JSValue>, uint64_t> InvokeFunction(FunctionHandle, std::vector<JSValue> const&) = 0;
+  // Invoke the calls in order and write their outcomes to results, one per
+  // call. after_call(i) runs between call i and the next one, so the state of
+  // the instance can be inspected after every call.
+  virtual void InvokeBatch(BatchCall const* calls, size_t count, uint64_t const* args, BatchResult* results,
+                           std::function<void(size_t)> const& after_call) = 0;
   virtual bool InitializeExecution() = 0;
   virtual bool InitializeModule(dfw::FuzzerRunnerCLArgs const&) = 0;
+  virtual void TeardownModule() = 0;
+  virtual bool RunIsolated(std::function<bool()> const& job) = 0;
   virtual bool MarshallMemoryImport(uint8_t*, size_t) = 0;
-  virtual std::vector<MemoryDiff> CompareInternalMemory(std::vector<uint8_t>& buffer) = 0;
+  virtual std::vector<MemoryRange> CompareInternalMemory(std::span<uint8_t> buffer) = 0;
   virtual std::vector<GlobalInfo> Globals() = 0;
   virtual void SetGlobal(std::string const& arg, JSValue value) = 0;
   virtual JSValue GetGlobal(std::string const& arg) = 0;
+  // Read or write the values of all globals at once, in the order of Globals()
+  virtual void ReadAllGlobals(std::span<JSValue> values) = 0;
+  virtual void WriteAllGlobals(std::span<JSValue const> values) = 0;
   virtual uintptr_t GetWasmMemoryAddress() = 0;
+  virtual size_t GetWasmMemorySize() = 0;
   virtual ~FuzzerRunnerBase();
 };
 
@@ -344,14 +583,19 @@ public:
     return runner.Functions();
   }
 
-  virtual std::optional<std::vector<uint8_t>> DumpFunction(std::string const& f) {
+  virtual std::optional<std::vector<uint8_t>> DumpFunction(FunctionHandle f) {
     return runner.DumpFunction(f);
   }
 
-  virtual std::tuple<std::optional<dfw::JSValue>, uint64_t> InvokeFunction(std::string const& f, std::vector<JSValue> const& args) {
+  virtual std::tuple<std::optional<dfw::JSValue>, uint64_t> InvokeFunction(FunctionHandle f, std::vector<JSValue> const& args) {
     return runner.InvokeFunction(f, args);
   }
 
+  virtual void InvokeBatch(BatchCall const* calls, size_t count, uint64_t const* args, BatchResult* results,
+                           std::function<void(size_t)> const& after_call) {
+    runner.InvokeBatch(calls, count, args, results, after_call);
+  }
+
   virtual bool InitializeExecution() {
     return runner.InitializeExecution();
   }
@@ -360,6 +604,14 @@ public:
     return runner.InitializeModule(a);
   }
 
+  virtual void TeardownModule() {
+    runner.TeardownModule();
+  }
+
+  virtual bool RunIsolated(std::function<bool()> const& job) {
+    return runner.RunIsolated(job);
+  }
+
   virtual bool MarshallMemoryImport(uint8_t* m, size_t s) {
     return runner.MarshallMemoryImport(m, s);
   }
@@ -376,13 +628,25 @@ public:
     return runner.GetGlobal(arg);
   }
 
-  virtual std::vector<MemoryDiff> CompareInternalMemory(std::vector<uint8_t>& buffer) {
+  virtual void ReadAllGlobals(std::span<JSValue> values) {
+    runner.ReadAllGlobals(values);
+  }
+
+  virtual void WriteAllGlobals(std::span<JSValue const> values) {
+    runner.WriteAllGlobals(values);
+  }
+
+  virtual std::vector<MemoryRange> CompareInternalMemory(std::span<uint8_t> buffer) {
     return runner.CompareInternalMemory(buffer);
   }
 
   virtual uintptr_t GetWasmMemoryAddress() {
     return runner.GetWasmMemoryAddress();
   }
+
+  virtual size_t GetWasmMemorySize() {
+    return runner.GetWasmMemorySize();
+  }
 };
 
 
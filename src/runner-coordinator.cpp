@@ -1,5 +1,8 @@
 #include "runner-common.h"
 #include "fuzzer-db.h"
+#include "result-ring.h"
+#include "divergence.h"
+#include "memory-hash.h"
 
 #include <fstream>
 #include <random>
@@ -13,10 +16,23 @@
 #include <future>
 #include <string>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <string_view>
+#include <map>
+#include <algorithm>
+#include <unordered_map>
 #include <filesystem>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <cassert>
 
@@ -39,13 +55,71 @@ struct CommandLineArgument {
 
   dfw::CommandLineArg<bool> dumpCore { "-dump-core" };
 
+  // exec: start a fresh runner for every test case
+  // server: keep a warm fork-server per engine and fork it for every test case
+  // persistent: keep one runner per engine that executes the test cases itself
+  dfw::CommandLineArg<char const*> runnerMode { "-runner-mode", false, "server" };
+  dfw::CommandLineArg<uint64_t> runnerMaxJobs { "-runner-max-jobs", false, 1000 };
+  dfw::CommandLineArg<uint64_t> runnerMaxRSS { "-runner-max-rss", false, 2048 }; // in MiB
+
+  // Number of parallel fuzzing lanes
+  dfw::CommandLineArg<uint64_t> jobs { "-jobs", false, 1 };
+
+  // Number of modules each lane generates ahead
+  dfw::CommandLineArg<uint64_t> prefetch { "-prefetch", false, 2 };
+
+  // Runner deadline per variant, a multiple of the observed execution time
+  // clamped between the floor and the ceiling (in ms)
+  dfw::CommandLineArg<uint64_t> timeoutMultiplier { "-timeout-multiplier", false, 5 };
+  dfw::CommandLineArg<uint64_t> timeoutFloor { "-timeout-floor", false, 200 };
+  dfw::CommandLineArg<uint64_t> timeoutCeiling { "-timeout-ceiling", false, 10000 };
+
+  // Result log format of the runners, json or binary
+  dfw::CommandLineArg<char const*> protocol { "-protocol", false, "binary" };
+
+  // Number of calls both engines keep running after their results diverged,
+  // negative to always run every call
+  dfw::CommandLineArg<int64_t> divergenceGrace { "-divergence-grace", false, 0 };
+
+  // Store every call of both engines instead of only the diverging ones
+  dfw::CommandLineArg<bool> storeAll { "-store-all" };
+
+  // Generator of the random blocks of the modules, philox or mt19937
+  dfw::CommandLineArg<char const*> rng { "-rng", false, "philox" };
+
+  // Number of times a module with the same content is executed, 0 for no limit
+  dfw::CommandLineArg<int64_t> maxModuleRuns { "-max-module-runs", false, 1 };
+
+  // How the runners find the memory written by a call: off, protect or soft-dirty
+  dfw::CommandLineArg<char const*> dirtyTracking { "-dirty-tracking", false, "off" };
+
+  // Result log transport of the runners, pipe or a shared memory ring (size in KiB)
+  dfw::CommandLineArg<char const*> transport { "-transport", false, "pipe" };
+  dfw::CommandLineArg<uint64_t> ringSize { "-ring-size", false, 1024 };
+
   char const* programCommand;
 
   CommandLineArgument(int argc, char const* argv[]) : programCommand(argv[0]) {
     dfw::CommandLineConsumer { argc, argv, 
                           std::ref(randomSize),
                           std::ref(outputFolder),
-                          std::ref(reproduceSeed)};
+                          std::ref(reproduceSeed),
+                          std::ref(runnerMode),
+                          std::ref(runnerMaxJobs),
+                          std::ref(runnerMaxRSS),
+                          std::ref(jobs),
+                          std::ref(prefetch),
+                          std::ref(timeoutMultiplier),
+                          std::ref(timeoutFloor),
+                          std::ref(timeoutCeiling),
+                          std::ref(protocol),
+                          std::ref(transport),
+                          std::ref(ringSize),
+                          std::ref(divergenceGrace),
+                          std::ref(storeAll),
+                          std::ref(maxModuleRuns),
+                          std::ref(rng),
+                          std::ref(dirtyTracking)};
   }
 };
 
@@ -144,14 +218,20 @@ void InstallSigaction() {
 }
 
 std::tuple<pid_t, int> SpawnTester(std::string const& path, 
-                                   std::string const& input_wasm,
-                                   std::string const& mem_path,
-                                   std::string const& arg_seed) {
+                                   dfw::RunnerJob const& job,
+                                   std::string const& protocol,
+                                   std::string const& dirty_tracking,
+                                   dfw::ResultRing* ring) {
   pid_t pid;
 
-  // Prepare pipe
+  // Prepare pipe, other lanes must not inherit it
   int fd[2];
-  pipe(fd);
+  pipe2(fd, O_CLOEXEC);
+
+  // Build argument before forking
+  std::string memories = job.MemoryList(),
+              arg_seeds = job.ArgSeedList(),
+              iter_count = std::to_string(job.iter_count);
 
   // Split
   pid = fork();
@@ -159,18 +239,26 @@ std::tuple<pid_t, int> SpawnTester(std::string const& path,
   if(pid == 0) {
     // Child process
     close(fd[0]); // Close read
-    dup2(fd[1], COMMON_FILE_DESCRIPTOR); // Copy to STDOUT
+    std::vector<std::pair<int, int>> fds { { fd[1], COMMON_FILE_DESCRIPTOR } };
+    if(ring != nullptr) {
+      // The pipe is kept to signal the end of the log
+      fds.emplace_back(ring->MemoryFd(), RING_MEMORY_FILE_DESCRIPTOR);
+      fds.emplace_back(ring->EventFd(), RING_EVENT_FILE_DESCRIPTOR);
+    }
+    dfw::InstallFileDescriptors(fds);
     int stdnull = open("/dev/null", O_RDONLY);
     dup2(stdnull, STDOUT_FILENO);
     dup2(stdnull, STDERR_FILENO); // Copy STDERR to STDOUT
-    close(fd[1]); // Close existing file
     close(stdnull);
     // Execute the runner
     execl(path.c_str(), path.c_str(),
-                        "-mode", "single",
-                        "-input", input_wasm.c_str(),
-                        "-memory", mem_path.c_str(),
-                        "-arg-seed", arg_seed.c_str(),
+                        "-mode", "multi",
+                        "-input", job.input.c_str(),
+                        "-memories", memories.c_str(),
+                        "-arg-seeds", arg_seeds.c_str(),
+                        "-invoke-count", iter_count.c_str(),
+                        "-protocol", protocol.c_str(),
+                        "-dirty-tracking", dirty_tracking.c_str(),
                         (char*)0);
     std::abort(); // Error
   } else { 
@@ -179,193 +267,989 @@ std::tuple<pid_t, int> SpawnTester(std::string const& path,
   }
 }
 
+std::tuple<pid_t, int> SpawnRunnerServer(std::string const& path,
+                                         std::vector<std::string> const& runner_args) {
+  pid_t pid;
+
+  // Prepare control channel, keeping the message boundaries
+  int sv[2];
+  if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+    return { -1, -1 };
+
+  // Build argument before forking
+  std::vector<char const*> argv { path.c_str() };
+  for(auto& arg : runner_args)
+    argv.push_back(arg.c_str());
+  argv.push_back(nullptr);
+
+  // Split
+  pid = fork();
+
+  if(pid == 0) {
+    // Child process
+    close(sv[0]); // Close coordinator end
+    if(sv[1] != CONTROL_FILE_DESCRIPTOR) {
+      dup2(sv[1], CONTROL_FILE_DESCRIPTOR); // Copy to the control channel
+      close(sv[1]);
+    } else {
+      fcntl(sv[1], F_SETFD, 0); // Keep it across exec
+    }
+    int stdnull = open("/dev/null", O_RDONLY);
+    dup2(stdnull, STDOUT_FILENO);
+    dup2(stdnull, STDERR_FILENO);
+    close(stdnull);
+    // Execute the runner
+    execv(path.c_str(), (char* const*)argv.data());
+    std::abort(); // Error
+  } else {
+    close(sv[1]); // Close server end
+    return { pid, sv[0] }; // Return process id and control socket
+  }
+}
+
+// Launch a runner process for a single test case
+class TesterLauncher {
+public:
+  // Returns the process id and the pipe carrying the log of the test cases.
+  // With a ring, the log is written to the ring and the pipe is only closed
+  // at the end of the log.
+  virtual std::tuple<pid_t, int> Spawn(dfw::RunnerJob const& job, dfw::ResultRing* ring) = 0;
+  // Collect the wait status of a process returned by Spawn
+  virtual int Reap(pid_t pid) = 0;
+  virtual ~TesterLauncher() { }
+};
+
+class ExecLauncher : public TesterLauncher {
+  std::string path;
+  std::string protocol;
+  std::string dirty_tracking;
+public:
+  ExecLauncher(std::string path, std::string protocol, std::string dirty_tracking) : 
+      path(std::move(path)), protocol(std::move(protocol)), dirty_tracking(std::move(dirty_tracking)) { }
+
+  std::tuple<pid_t, int> Spawn(dfw::RunnerJob const& job, dfw::ResultRing* ring) override {
+    return SpawnTester(path, job, protocol, dirty_tracking, ring);
+  }
+
+  int Reap(pid_t pid) override {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return status;
+  }
+};
+
+// Talks to a long-lived runner over its control channel. The runner is either
+// a fork server, which forks a child per test case, or a persistent runner,
+// which executes the test cases itself and retires after a number of jobs.
+class ServerLauncher : public TesterLauncher {
+  std::string path;
+  std::vector<std::string> runner_args;
+  pid_t server_pid { -1 };
+  int control { -1 };
+
+  void Start() {
+    std::tie(server_pid, control) = SpawnRunnerServer(path, runner_args);
+  }
+
+  int Stop() {
+    int status = W_EXITCODE(1, 0);
+    if(control >= 0) close(control); // Server exits when the channel is closed
+    if(server_pid > 0) {
+      kill(server_pid, SIGKILL);
+      waitpid(server_pid, &status, 0);
+    }
+    server_pid = -1;
+    control = -1;
+    return status;
+  }
+
+  pid_t Submit(std::string const& job, std::vector<int> const& fds) {
+    if(!dfw::SendControlMessage(control, job, fds))
+      return -1;
+
+    auto reply = dfw::ReceiveControlMessage(control);
+    if(!reply.has_value() || reply->rfind("pid ", 0) != 0)
+      return -1;
+
+    return (pid_t)std::strtol(reply->c_str() + 4, nullptr, 10);
+  }
+
+public:
+  ServerLauncher(std::string path, std::vector<std::string> runner_args) : 
+      path(std::move(path)), runner_args(std::move(runner_args)) { 
+    Start();
+  }
+
+  ~ServerLauncher() {
+    Stop();
+  }
+
+  std::tuple<pid_t, int> Spawn(dfw::RunnerJob const& job, dfw::ResultRing* ring) override {
+    int fd[2];
+    if(pipe2(fd, O_CLOEXEC) != 0)
+      return { -1, -1 };
+
+    std::vector<int> fds { fd[1] };
+    if(ring != nullptr) {
+      fds.push_back(ring->MemoryFd());
+      fds.push_back(ring->EventFd());
+    }
+
+    auto msg = job.Serialize();
+    pid_t pid = Submit(msg, fds);
+
+    if(pid < 0) {
+      // The server is gone or has retired, start a new one and retry once
+      Stop();
+      Start();
+      pid = Submit(msg, fds);
+    }
+
+    close(fd[1]); // The runner holds its own copy of the write end
+    if(pid < 0) {
+      close(fd[0]);
+      return { -1, -1 };
+    }
+    return { pid, fd[0] };
+  }
+
+  int Reap(pid_t pid) override {
+    auto reply = dfw::ReceiveControlMessage(control);
+    if(reply.has_value() && reply->rfind("exit ", 0) == 0) {
+      char* end;
+      pid_t exited = (pid_t)std::strtol(reply->c_str() + 5, &end, 10);
+      if(exited == pid)
+        return (int)std::strtol(end, nullptr, 10);
+    }
+
+    // Lost the server. When the test case ran inside the server process
+    // itself, its wait status is the status of the test case.
+    bool in_server = pid == server_pid;
+    int status = Stop();
+    Start();
+    return in_server ? status : W_EXITCODE(1, 0);
+  }
+};
+
+std::unique_ptr<TesterLauncher> MakeLauncher(CommandLineArgument& args, std::string path) {
+  if(std::strcmp(args.runnerMode, "exec") == 0) {
+    return std::make_unique<ExecLauncher>(std::move(path), args.protocol.value, args.dirtyTracking.value);
+  } else if(std::strcmp(args.runnerMode, "persistent") == 0) {
+    return std::make_unique<ServerLauncher>(std::move(path), std::vector<std::string> { 
+      "-mode", "persistent",
+      "-max-jobs", std::to_string(args.runnerMaxJobs.value),
+      "-max-rss", std::to_string(args.runnerMaxRSS.value),
+      "-protocol", args.protocol.value,
+      "-dirty-tracking", args.dirtyTracking.value
+    });
+  } else {
+    return std::make_unique<ServerLauncher>(std::move(path), std::vector<std::string> { 
+      "-mode", "server",
+      "-protocol", args.protocol.value,
+      "-dirty-tracking", args.dirtyTracking.value
+    });
+  }
+}
+
 std::tuple<pid_t, int, int> SpawnGenerator(
           std::string const& argfolder, 
           uint64_t seed, 
-          uint64_t block_size) {
+          uint64_t block_size,
+          std::string const& output,
+          std::string const& memory,
+          std::string const& rng) {
   pid_t pid;
 
-  // Prepare pipe
-  int fd[2];
-  pipe(fd);
+  // Prepare pipes for both directions
+  int to_child[2], from_child[2];
+  pipe2(to_child, O_CLOEXEC);
+  pipe2(from_child, O_CLOEXEC);
+
+  // Build argument
+  std::string seed_str = std::to_string(seed),
+              block_size_str = std::to_string(block_size),
+              path = argfolder + "random-gen";
 
   // Split
   pid = fork();
 
   if(pid == 0) {
     // Child process
-    
-    dup2(fd[0], STDIN_FILENO); // Copy to STDIN
-    dup2(fd[1], STDOUT_FILENO); // Copy to STDOUT
-    dup2(fd[1], STDERR_FILENO); // Copy STDERR to STDOUT
-    close(fd[1]); // Close existing file
-    close(fd[0]); // Close existing file
-
-     // Build argument
-    std::string seed_str = std::to_string(seed),
-                block_size_str = std::to_string(block_size),
-                path = argfolder + "random-gen";
+    dup2(to_child[0], STDIN_FILENO); // Copy to STDIN
+    dup2(from_child[1], STDOUT_FILENO); // Copy to STDOUT
 
     // Execute the runner
     execl(path.c_str(), path.c_str(),
                         "-block-size", block_size_str.c_str(),
                         "-seed", seed_str.c_str(),
-                        "-output", "/dev/shm/randomized-wasm",
-                        "-memory", "/dev/shm/randomized-memory",
+                        "-output", output.c_str(),
+                        "-memory", memory.c_str(),
+                        "-rng", rng.c_str(),
                         (char*)0);
     std::abort(); // Error
   } else { 
-    return { pid, fd[1], fd[0] }; // Return process id and pipe fileno
+    close(to_child[0]);
+    close(from_child[1]);
+    return { pid, to_child[1], from_child[0] }; // Return process id and pipe fileno
   }
 }
 
-bool GetLineOrEnd(std::stringstream& str, std::string& out) {
-  std::getline(str, out);
-  if(out == "ENDCOMPARE") return true;
-  else return false;
-}
+struct GeneratedModule {
+  std::string path;
+  size_t size;
+  size_t memory_pages;
+};
 
+// Keeps the generator working ahead of the runners. Modules are generated into
+// a ring of depth + 1 files; a file is only regenerated once the step using it
+// is released, so up to depth modules are ready while one is being executed.
+class GeneratorPipeline {
+  pid_t pid;
+  __gnu_cxx::stdio_filebuf<char> filebuf_out;
+  __gnu_cxx::stdio_filebuf<char> filebuf_in;
+  std::ostream os;
+  std::istream is;
+  std::string base_path;
+
+  void Request(std::string const& path) {
+    os << "w " << path << std::endl;
+    os.flush();
+  }
 
+public:
+  GeneratorPipeline(std::string const& argfolder, uint64_t seed, uint64_t block_size,
+                    std::string base_path, std::string const& memory, std::string const& rng, size_t depth) :
+      pid(-1), os(nullptr), is(nullptr), base_path(std::move(base_path)) {
+    auto [gen_pid, to_gen, from_gen] = SpawnGenerator(argfolder, seed, block_size, 
+                                                      this->base_path, memory, rng);
+    pid = gen_pid;
+    filebuf_out = __gnu_cxx::stdio_filebuf<char>(to_gen, std::ios::out);
+    filebuf_in = __gnu_cxx::stdio_filebuf<char>(from_gen, std::ios::in);
+    os.rdbuf(&filebuf_out);
+    is.rdbuf(&filebuf_in);
+
+    // The generator processes the requests in order
+    for(size_t slot = 0; slot <= depth; slot++)
+      Request(dfw::strjoin(this->base_path, "-", std::to_string(slot)));
+  }
 
-void CompareLogs(std::string& v8_log, 
-                 std::string& moz_log,
-                 dfw::db::Entities& entities,
-                 quince::serial memstep,
-                 quince::serial v8_id,
-                 quince::serial moz_id) {
+  ~GeneratorPipeline() {
+    os << "q" << std::endl;
+    os.flush();
+    filebuf_out.close();
+    filebuf_in.close();
+    if(pid > 0) 
+      waitpid(pid, NULL, 0);
+  }
+
+  // Wait for the oldest pending module
+  std::optional<GeneratedModule> Next() {
+    std::string line;
+    while(std::getline(is, line)) {
+      // Skip anything else the generator prints
+      if(line.rfind("ready ", 0) != 0)
+        continue;
+
+      std::istringstream reply(line.substr(6));
+      GeneratedModule module;
+      if(reply >> module.path >> module.size >> module.memory_pages)
+        return module;
+    }
+    return std::nullopt; // Generator is gone
+  }
 
+  // The module file can be overwritten by a new module
+  void Release(GeneratedModule const& module) {
+    Request(module.path);
+  }
+};
+
+// Parse one line of a JSON runner log, a truncated line of a crashed runner is rejected
+std::optional<dfw::CallRecord> ParseCallRecord(std::string_view line) {
   using namespace rapidjson;
 
-  if(v8_log.length() == 0 || moz_log.length() == 0) { 
-    if (v8_log.length() == 0)
-      std::cout << "v8 empty log ";
-    if (moz_log.length() == 0)
-      std::cout << "moz empty log ";
-    return; 
+  Document doc;
+  doc.Parse(line.data(), line.size());
+  if(doc.HasParseError() || !doc.IsObject())
+    return std::nullopt;
+
+  dfw::CallRecord record;
+  std::string func_name = doc["FunctionName"].GetString();
+  record.function_no = std::strtol(&func_name[4], nullptr, 10);
+  record.elapsed = std::strtol(doc["Elapsed"].GetString(), nullptr, 10);
+  record.success = doc["Success"].GetBool();
+
+  for(auto& arg : doc["Args"].GetArray())
+    record.args.push_back(std::strtol(arg.GetString(), nullptr, 10));
+
+  if(record.success && doc.HasMember("Result"))
+    record.result = std::strtol(doc["Result"].GetString(), nullptr, 10);
+
+  if(doc.HasMember("MemoryDiff")) {
+    std::vector<dfw::MemoryDiff> memory_diff;
+    for(auto& member : doc["MemoryDiff"].GetObject()) {
+      memory_diff.emplace_back((uint32_t)std::strtol(member.name.GetString(), nullptr, 10),
+                               (uint8_t)member.value[0].GetInt64(),
+                               (uint8_t)member.value[1].GetInt64());
+    }
+    record.memory_diff = dfw::PackMemoryDiff(memory_diff);
   }
 
-  // Fix the crash cases
-  if(v8_log.length() > 0 && *v8_log.rbegin() != ']') v8_log += ']';  
-  if(moz_log.length() > 0 && *moz_log.rbegin() != ']') moz_log += ']';
-  
-  Document v8_log_doc;
-  v8_log_doc.Parse(v8_log.c_str());
+  if(doc.HasMember("MemoryRoot"))
+    record.memory_root = std::strtoull(doc["MemoryRoot"].GetString(), nullptr, 10);
+
+  if(doc.HasMember("GlobalDiff")) {
+    for(auto& member : doc["GlobalDiff"].GetObject()) {
+      record.global_diff.push_back(dfw::GlobalChange {
+        std::strtol(member.name.GetString(), nullptr, 10),
+        (int64_t)std::strtoull(member.value[0].GetString(), nullptr, 10),
+        (int64_t)std::strtoull(member.value[1].GetString(), nullptr, 10)
+      });
+    }
+  }
 
-  Document moz_log_doc;
-  moz_log_doc.Parse(moz_log.c_str());
+  return record;
+}
 
-  std::cout << "Processing Log:" << std::endl;
+// A call of a runner log. Binary records are kept as their frame and only
+// decoded when the digests of both engines differ or the call is stored.
+class LoggedCall {
+  std::string frame;
+  std::optional<dfw::CallRecord> record;
 
-  //std::cout << v8_log << std::endl << std::endl;
-  //std::cout << moz_log << std::endl;
+public:
+  uint64_t digest;
+
+  LoggedCall(std::string_view frame, uint64_t digest) : frame(frame), digest(digest) { }
+  LoggedCall(dfw::CallRecord record) : record(std::move(record)), digest(dfw::DigestCallRecord(*this->record)) { }
+
+  // nullptr if the frame is malformed
+  dfw::CallRecord* Decode() {
+    if(!record.has_value()) {
+      dfw::RecordFrame decoded;
+      dfw::DecodeFrame(frame, decoded);
+      if(decoded.kind != dfw::FrameKind::Call)
+        return nullptr;
+      record = std::move(decoded.call);
+      frame.clear();
+    }
+    return &*record;
+  }
+};
 
-  // Starts with an array
-  auto v8_log_iter = v8_log_doc.Begin();
-  auto moz_log_iter = moz_log_doc.Begin();
+// Store the n-th function call of both engines
+void StoreCallPair(dfw::db::Entities& entities,
+                   quince::serial memstep,
+                   quince::serial v8_id,
+                   quince::serial moz_id,
+                   int64_t sequence,
+                   dfw::CallRecord const& v8_exec,
+                   dfw::CallRecord const& moz_exec) {
+  assert(v8_exec.function_no == moz_exec.function_no);
+
+  auto functioncall_id = entities.StoreFunctionCall(dfw::db::FunctionCall {
+                           {}, memstep, sequence, v8_exec.function_no
+                         });
+  
+  // Store the args
+  for(auto argval : v8_exec.args)
+    entities.StoreFunctionArgs(dfw::db::FunctionArgs { {}, functioncall_id, argval });
 
-  int64_t sequence = 0;
+  auto result_of = [] (dfw::CallRecord const& exec) {
+    return exec.result.has_value() ? boost::optional<int64_t> { *exec.result } : boost::none;
+  };
 
-  // When everything is still the same
-  while(v8_log_iter != v8_log_doc.End() && moz_log_iter != moz_log_doc.End()) {
-    
-    // Get the object
-    decltype(auto) v8_exec = v8_log_iter->GetObject();
-    decltype(auto) moz_exec = moz_log_iter->GetObject();
+  // Store call each test case
+  auto v8_case = entities.StoreTestCaseCall(dfw::db::TestCaseCall { {}, v8_id, functioncall_id, 
+                                            v8_exec.success, v8_exec.elapsed, result_of(v8_exec) });
+  
+  auto moz_case = entities.StoreTestCaseCall(dfw::db::TestCaseCall { {}, moz_id, functioncall_id, 
+                                             moz_exec.success, moz_exec.elapsed, result_of(moz_exec) });
 
-    // Continue
-    ++v8_log_iter;
-    ++moz_log_iter;
+  for(auto [exec, test_case] : { std::make_tuple(&v8_exec, v8_case), std::make_tuple(&moz_exec, moz_case) }) {
+    // The database keeps one row per changed byte
+    for(auto& range : exec->memory_diff) {
+      for(size_t i = 0; i < range.after.size(); ++i) {
+        entities.StoreMemoryDiff(dfw::db::MemoryDiff {
+          {}, test_case, (int64_t)(range.offset + i), range.before[i], range.after[i]
+        });
+      }
+    }
+    for(auto& global : exec->global_diff) {
+      entities.StoreGlobalDiff(dfw::db::GlobalDiff {
+        {}, test_case, global.index, global.before, global.after
+      });
+    }
+  }
+}
 
-    std::string func_name = v8_exec["FunctionName"].GetString();
+struct ChildOutput {
+  bool timeout;
+  std::chrono::milliseconds elapsed;
+};
 
-    assert(std::strcmp(v8_exec["FunctionName"].GetString(), 
-                       moz_exec["FunctionName"].GetString()) == 0);
+// Supervises the output of every runner from a single thread. Each runner is
+// watched through its result pipe, a pidfd and its deadline; the earliest
+// deadline of all runners is armed on one timerfd. The output is passed to
+// the sink of the runner as it arrives.
+class ChildSupervisor {
+  using Clock = std::chrono::steady_clock;
+
+  struct Child {
+    pid_t pid;
+    int pipe_fd;
+    int pid_fd;
+    dfw::ResultRing* ring;
+    Clock::time_point start;
+    Clock::time_point deadline;
+    bool timeout { false };
+    std::function<void(char const*, size_t)> sink;
+    std::promise<ChildOutput> promise;
+    std::function<void()> notify;
+  };
+
+  int epoll_fd;
+  int timer_fd;
+  int wake_fd;
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Child>> incoming;
+  std::vector<std::tuple<pid_t, Clock::time_point>> reschedules;
+  bool stop { false };
+
+  // Only touched by the supervisor thread
+  std::unordered_map<int, Child*> by_fd;
+  std::vector<std::unique_ptr<Child>> children;
+
+  std::thread worker;
+
+  void Add(int fd, Child* child) {
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    by_fd[fd] = child;
+  }
 
-    auto func_num = std::strtol(&func_name[4], nullptr, 10);
+  void Remove(int fd, bool owned = true) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    by_fd.erase(fd);
+    if(owned)
+      close(fd);
+  }
 
-    auto v8_elapsed = std::strtol(v8_exec["Elapsed"].GetString(), nullptr, 10); 
-    auto moz_elapsed = std::strtol(moz_exec["Elapsed"].GetString(), nullptr, 10);
+  // Pass everything published in the ring to the sink, then sleep on the eventfd
+  void DrainRing(Child* child) {
+    std::string buffer;
+    do {
+      uint64_t count;
+      read(child->ring->EventFd(), &count, sizeof(count));
+
+      buffer.clear();
+      if(child->ring->Read(buffer) > 0)
+        child->sink(buffer.data(), buffer.size());
+    } while(!child->ring->Arm());
+  }
 
-    auto v8_success = v8_exec["Success"].GetBool();
-    auto moz_success = moz_exec["Success"].GetBool();
+  // Returns false when the writing end is closed
+  bool Drain(Child* child) {
+    char buffer[4096];
+    while(true) {
+      auto n = read(child->pipe_fd, buffer, sizeof(buffer));
+      if(n > 0)
+        child->sink(buffer, n);
+      else if(n == 0)
+        return false;
+      else if(errno != EINTR)
+        return errno == EAGAIN;
+    }
+  }
 
-    auto functioncall_id = entities.StoreFunctionCall(dfw::db::FunctionCall {
-                             {}, memstep, sequence, func_num
-                           });
-    
-    // Store the args
-    for(auto& arg : v8_exec["Args"].GetArray()) {
-      auto argval = std::strtol(arg.GetString(), nullptr, 10);
-      entities.StoreFunctionArgs(dfw::db::FunctionArgs { {}, functioncall_id, argval });
+  void Finish(Child* child) {
+    Remove(child->pipe_fd);
+    if(child->pid_fd >= 0)
+      Remove(child->pid_fd);
+    if(child->ring != nullptr) {
+      DrainRing(child); // The runner published everything before it closed the pipe
+      Remove(child->ring->EventFd(), false);
     }
 
-    boost::optional<int64_t> v8_result, moz_result;
-    if(v8_success && v8_exec.HasMember("Result")) { 
-      v8_result = std::strtol(v8_exec["Result"].GetString(), nullptr, 10); 
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - child->start);
+    child->promise.set_value(ChildOutput { child->timeout, elapsed });
+    if(child->notify)
+      child->notify();
+
+    auto it = std::find_if(children.begin(), children.end(), 
+                           [child] (auto& c) { return c.get() == child; });
+    children.erase(it);
+  }
+
+  void ArmTimer() {
+    itimerspec spec {};
+    if(!children.empty()) {
+      auto earliest = std::min_element(children.begin(), children.end(), 
+                                       [] (auto& a, auto& b) { return a->deadline < b->deadline; });
+      auto since_epoch = (*earliest)->deadline.time_since_epoch();
+      auto sec = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+      auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch - sec);
+      spec.it_value.tv_sec = sec.count();
+      spec.it_value.tv_nsec = nsec.count();
+      if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1; // Zero disarms the timer
     }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+  }
 
-    if(moz_success && moz_exec.HasMember("Result")) { 
-      moz_result = std::strtol(moz_exec["Result"].GetString(), nullptr, 10); 
+  void Expire() {
+    auto now = Clock::now();
+    std::vector<Child*> expired;
+    for(auto& child : children) {
+      if(child->deadline > now)
+        continue;
+      
+      if(!child->timeout) {
+        // Kill the runner and give it a moment to close the pipe
+        std::cout << " * process timeout, closing... * ";
+        kill(child->pid, SIGKILL);
+        child->timeout = true;
+        child->deadline = now + std::chrono::seconds(1);
+      } else {
+        expired.push_back(child.get()); // Pipe is held by someone else
+      }
     }
+    for(auto child : expired)
+      Finish(child);
+  }
 
-    // Store call each test case
-    auto v8_case = entities.StoreTestCaseCall(dfw::db::TestCaseCall { {}, v8_id, functioncall_id, 
-                                              v8_success, v8_elapsed, v8_result });
-    
-    auto moz_case = entities.StoreTestCaseCall(dfw::db::TestCaseCall { {}, moz_id, functioncall_id, 
-                                               moz_success, moz_elapsed, moz_result });
+  void Loop() {
+    epoll_event events[64];
+    while(true) {
+      int n = epoll_wait(epoll_fd, events, 64, -1);
+      if(n < 0) {
+        if(errno == EINTR) continue;
+        std::cout << "ERROR: epoll_wait failed, errno: " << errno << std::endl;
+        std::abort();
+      }
 
-    // Check if there is memory diff
-    if(v8_exec.HasMember("MemoryDiff")) {
-      for(auto& member : v8_exec["MemoryDiff"].GetObject()) {
-        auto index = std::strtol(member.name.GetString(), nullptr, 10);
-        auto old_val = member.value[0].GetInt64();
-        auto new_val = member.value[1].GetInt64();
+      for(int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if(fd == wake_fd) {
+          uint64_t count;
+          read(wake_fd, &count, sizeof(count));
+
+          std::unique_lock lock(mutex);
+          if(stop) 
+            return;
+          for(auto& child : incoming) {
+            Add(child->pipe_fd, child.get());
+            if(child->pid_fd >= 0)
+              Add(child->pid_fd, child.get());
+            if(child->ring != nullptr) {
+              Add(child->ring->EventFd(), child.get());
+              DrainRing(child.get());
+            }
+            children.push_back(std::move(child));
+          }
+          incoming.clear();
 
-        entities.StoreMemoryDiff(dfw::db::MemoryDiff {
-          {}, v8_case, index, old_val, new_val
-        });
+          for(auto [pid, deadline] : reschedules) {
+            for(auto& child : children) {
+              // A killed runner keeps its grace period
+              if(child->pid == pid && !child->timeout)
+                child->deadline = std::min(child->deadline, deadline);
+            }
+          }
+          reschedules.clear();
+        } else if(fd == timer_fd) {
+          uint64_t count;
+          read(timer_fd, &count, sizeof(count));
+          Expire();
+        } else {
+          // The child may already be finished by an earlier event of this round
+          auto it = by_fd.find(fd);
+          if(it == by_fd.end()) 
+            continue;
+
+          Child* child = it->second;
+          if(child->ring != nullptr && fd == child->ring->EventFd()) {
+            DrainRing(child);
+            continue;
+          }
+
+          // The pipe is drained when the process exited, since everything it
+          // wrote is already in the pipe
+          if(!Drain(child) || fd == child->pid_fd)
+            Finish(child);
+        }
       }
+
+      ArmTimer();
     }
-    if(moz_exec.HasMember("MemoryDiff")) {
-      for(auto& member : moz_exec["MemoryDiff"].GetObject()) {
-        auto index = std::strtol(member.name.GetString(), nullptr, 10);
-        auto old_val = member.value[0].GetInt64();
-        auto new_val = member.value[1].GetInt64();
+  }
 
-        entities.StoreMemoryDiff(dfw::db::MemoryDiff {
-          {}, moz_case, index, old_val, new_val
-        });
-      }
+public:
+  ChildSupervisor() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    for(int fd : { timer_fd, wake_fd }) {
+      epoll_event ev {};
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
     }
 
-    // Check if there is a global diff
-    if(v8_exec.HasMember("GlobalDiff")) {
-      for(auto& member : v8_exec["GlobalDiff"].GetObject()) {
-        auto index = std::strtol(member.name.GetString(), nullptr, 10);
-        auto old_val = (int64_t)std::strtoull(member.value[0].GetString(), nullptr, 10);
-        auto new_val = (int64_t)std::strtoull(member.value[1].GetString(), nullptr, 10);
+    worker = std::thread([this] { Loop(); });
+  }
 
-        entities.StoreGlobalDiff(dfw::db::GlobalDiff {
-          {}, moz_case, index, old_val, new_val
-        });
+  ~ChildSupervisor() {
+    {
+      std::unique_lock lock(mutex);
+      stop = true;
+    }
+    uint64_t one = 1;
+    write(wake_fd, &one, sizeof(one));
+    worker.join();
+
+    // Release the runners that are still watched
+    for(auto& child : children) {
+      kill(child->pid, SIGKILL);
+      close(child->pipe_fd);
+      if(child->pid_fd >= 0) close(child->pid_fd);
+      child->promise.set_value(ChildOutput { true, std::chrono::milliseconds { 0 } });
+      if(child->notify)
+        child->notify();
+    }
+
+    close(epoll_fd);
+    close(timer_fd);
+    close(wake_fd);
+  }
+
+  // Takes ownership of the pipe, the output is complete when the pipe is closed
+  // or the process exited. The output is read from the ring if there is one,
+  // which must stay alive until the future is ready. The process is killed after the timeout. The sink
+  // and notify are called from the supervisor thread, notify once the future
+  // is ready.
+  std::future<ChildOutput> Watch(pid_t pid, int pipe_fd, dfw::ResultRing* ring, 
+                                 std::chrono::milliseconds timeout,
+                                 std::function<void(char const*, size_t)> sink,
+                                 std::function<void()> notify = nullptr) {
+    auto child = std::make_unique<Child>();
+    child->pid = pid;
+    child->pipe_fd = pipe_fd;
+    child->ring = ring;
+    child->sink = std::move(sink);
+    child->pid_fd = (int)syscall(SYS_pidfd_open, pid, 0); // Pipe EOF only when unsupported
+    child->start = Clock::now();
+    child->deadline = child->start + timeout;
+    child->notify = std::move(notify);
+    fcntl(pipe_fd, F_SETFL, fcntl(pipe_fd, F_GETFL) | O_NONBLOCK);
+
+    auto ret = child->promise.get_future();
+    {
+      std::unique_lock lock(mutex);
+      incoming.push_back(std::move(child));
+    }
+    uint64_t one = 1;
+    write(wake_fd, &one, sizeof(one));
+    return ret;
+  }
+
+  // Bring the deadline of a watched process forward, never extends it
+  void Reschedule(pid_t pid, Clock::time_point deadline) {
+    {
+      std::unique_lock lock(mutex);
+      reschedules.emplace_back(pid, deadline);
+    }
+    uint64_t one = 1;
+    write(wake_fd, &one, sizeof(one));
+  }
+};
+
+// Derives runner deadlines from the execution times observed so far, per
+// engine and per module size (bucketed by powers of two). All durations
+// are per variant.
+class TimeoutPolicy {
+  static constexpr size_t window = 64;
+  static constexpr size_t min_samples = 8;
+
+  uint64_t multiplier;
+  std::chrono::milliseconds floor;
+  std::chrono::milliseconds ceiling;
+
+  std::mutex mutex;
+  std::map<std::tuple<std::string, int>, std::deque<std::chrono::milliseconds>> history;
+
+  static int Bucket(size_t module_size) {
+    int bucket = 0;
+    while(module_size >>= 1) bucket++;
+    return bucket;
+  }
+
+  std::chrono::milliseconds Clamp(std::chrono::milliseconds value) const {
+    return std::clamp(value, floor, ceiling);
+  }
+
+public:
+  TimeoutPolicy(uint64_t multiplier, uint64_t floor, uint64_t ceiling) :
+      multiplier(std::max<uint64_t>(multiplier, 1)), 
+      floor(floor), ceiling(std::max(floor, ceiling)) { }
+
+  void Record(std::string const& engine, size_t module_size, std::chrono::milliseconds per_variant) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& samples = history[{ engine, Bucket(module_size) }];
+    samples.push_back(per_variant);
+    if(samples.size() > window)
+      samples.pop_front();
+  }
+
+  // Deadline before any engine finished: a multiple of the 95th percentile
+  // of this engine, or the ceiling while there is too little history
+  std::chrono::milliseconds Initial(std::string const& engine, size_t module_size, size_t variants) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = history.find({ engine, Bucket(module_size) });
+    if(it == history.end() || it->second.size() < min_samples)
+      return ceiling * variants;
+
+    std::vector<std::chrono::milliseconds> sorted { it->second.begin(), it->second.end() };
+    auto p95 = sorted.begin() + (sorted.size() * 95) / 100;
+    std::nth_element(sorted.begin(), p95, sorted.end());
+    return Clamp(*p95 * multiplier) * variants;
+  }
+
+  // Deadline once the other engine finished in the observed time
+  std::chrono::milliseconds Relative(std::chrono::milliseconds observed_per_variant, size_t variants) const {
+    return Clamp(observed_per_variant * multiplier) * variants;
+  }
+};
+
+struct TesterOutcome {
+  bool success;
+  bool timeout;
+  int signal;
+  bool stopped; // Killed after the engines diverged
+  std::optional<uint64_t> digest; // Rolling digest of a completed variant
+};
+
+// Execute all variants of the job, splitting the log at the end of every variant.
+// When the runner dies in the middle of a variant, that variant takes the outcome
+// of the process and the remaining variants are executed by a new runner.
+class VariantRun {
+  TesterLauncher* launcher;
+  dfw::RunnerJob job;
+  std::vector<dfw::RunnerVariant> variants;
+  std::string name;
+  dfw::ResultProtocol protocol;
+  dfw::ResultRing* ring;
+  std::function<void(size_t, LoggedCall)> on_record;
+
+  std::chrono::steady_clock::time_point start;
+  std::future<ChildOutput> output;
+
+  // Only touched by the supervisor thread while the runner is running
+  std::string partial;
+
+  // Stop is called by the supervisor thread for records of the other engine,
+  // possibly while the lane thread starts or finishes this runner. The lane
+  // thread writes these only with the mutex held.
+  std::mutex stop_mutex;
+  pid_t pid { -1 };
+  size_t variant_base { 0 };
+  std::vector<std::tuple<bool, std::optional<uint64_t>>> ended;
+  std::optional<size_t> stop_variant; // Read by Record without the mutex, set before the runner is watched
+  bool exited { true };
+
+  void Record(size_t variant, LoggedCall record) {
+    // The variants after a stopped one are executed again by a new runner
+    if(stop_variant.has_value() && variant > *stop_variant)
+      return;
+    on_record(variant, std::move(record));
+  }
+
+  void Consume(char const* data, size_t len) {
+    partial.append(data, len);
+
+    if(protocol == dfw::ResultProtocol::Binary) {
+      // Only the digest of a call is read here, the comparator decodes it if needed
+      size_t begin = 0, frame_size;
+      dfw::FrameKind kind;
+      uint64_t digest;
+      std::string_view buffer { partial };
+      while((frame_size = dfw::PeekFrame(buffer.substr(begin), kind, digest)) != 0) {
+        auto frame = buffer.substr(begin, frame_size);
+        begin += frame_size;
+        if(kind == dfw::FrameKind::VariantEnd) {
+          dfw::RecordFrame end;
+          dfw::DecodeFrame(frame, end);
+          std::lock_guard<std::mutex> lock(stop_mutex);
+          ended.emplace_back(end.variant_success, end.digest);
+        } else if(kind == dfw::FrameKind::Call) {
+          Record(variant_base + ended.size(), LoggedCall { frame, digest });
+        }
       }
+      partial.erase(0, begin);
+      return;
     }
-    if(moz_exec.HasMember("GlobalDiff")) {
-      for(auto& member : moz_exec["GlobalDiff"].GetObject()) {
-        auto index = std::strtol(member.name.GetString(), nullptr, 10);
-        auto old_val = (int64_t)std::strtoull(member.value[0].GetString(), nullptr, 10);
-        auto new_val = (int64_t)std::strtoull(member.value[1].GetString(), nullptr, 10);
 
-        entities.StoreGlobalDiff(dfw::db::GlobalDiff {
-          {}, moz_case, index, old_val, new_val
-        });
+    size_t begin = 0, end;
+    while((end = partial.find('\n', begin)) != std::string::npos) {
+      std::string_view line { partial.data() + begin, end - begin };
+      begin = end + 1;
+
+      if(line.rfind(VARIANT_END_MARKER, 0) == 0) {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        ended.emplace_back(line.back() == '1', std::nullopt);
+      } else if(!line.empty()) {
+        if(auto record = ParseCallRecord(line); record.has_value())
+          Record(variant_base + ended.size(), LoggedCall { std::move(*record) });
       }
     }
-    sequence++;
-    std::cout << "o";
+    partial.erase(0, begin);
   }
-}
+
+public:
+  std::vector<TesterOutcome> outcomes;
+
+  // on_record receives every complete call record with the index of its variant
+  VariantRun(TesterLauncher* launcher, dfw::RunnerJob job, std::string name,
+             dfw::ResultProtocol protocol, dfw::ResultRing* ring,
+             std::function<void(size_t, LoggedCall)> on_record) :
+      launcher(launcher), job(std::move(job)), name(std::move(name)), protocol(protocol),
+      ring(ring), on_record(std::move(on_record)) { 
+    variants = this->job.variants;
+  }
+
+  bool Done() const { return outcomes.size() == variants.size(); }
+  bool Running() const { return !Done() && pid >= 0; }
+  size_t Remaining() const { return variants.size() - outcomes.size(); }
+  std::string const& Name() const { return name; }
+
+  // Kill the runner if it is still executing the variant. Only called from
+  // the supervisor thread.
+  void Stop(size_t variant) {
+    std::lock_guard<std::mutex> lock(stop_mutex);
+    if(exited || pid <= 0 || stop_variant.has_value() || variant_base + ended.size() != variant)
+      return;
+    stop_variant = variant;
+    kill(pid, SIGKILL);
+  }
+
+  bool Ready() const { 
+    return !Running() || output.wait_for(std::chrono::seconds(0)) == std::future_status::ready; 
+  }
+
+  // Launch a runner for the remaining variants
+  void Start(ChildSupervisor& supervisor, std::chrono::milliseconds timeout, 
+             std::function<void()> notify) {
+    {
+      std::lock_guard<std::mutex> lock(stop_mutex);
+      pid = -1;
+    }
+    if(Done()) 
+      return;
+
+    job.variants.assign(variants.begin() + outcomes.size(), variants.end());
+    if(ring != nullptr)
+      ring->Reset(); // Nobody is writing to it anymore
+    auto [spawned, pipeno] = launcher->Spawn(job, ring);
+    if(spawned < 0) {
+      std::cout << " * cannot start " << name << " * ";
+      while(!Done())
+        outcomes.push_back(TesterOutcome { false, false, 0, false, std::nullopt });
+      return;
+    }
+    start = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(stop_mutex);
+      pid = spawned;
+      variant_base = outcomes.size();
+      stop_variant.reset();
+      exited = false;
+    }
+    output = supervisor.Watch(spawned, pipeno, ring, timeout, 
+                              [this] (char const* data, size_t len) { Consume(data, len); },
+                              [this, notify] { 
+                                {
+                                  std::lock_guard<std::mutex> lock(stop_mutex);
+                                  exited = true;
+                                }
+                                notify(); 
+                              });
+  }
+
+  // Limit the runner to the given time since it was started
+  void Shorten(ChildSupervisor& supervisor, std::chrono::milliseconds limit) {
+    if(Running())
+      supervisor.Reschedule(pid, start + limit);
+  }
+
+  // Wait for the runner launched by Start, returns the execution time per
+  // variant if the runner finished all its variants on its own
+  std::optional<std::chrono::milliseconds> Finish() {
+    if(!Running()) 
+      return std::nullopt;
+
+    size_t launched = Remaining();
+    std::optional<std::chrono::milliseconds> per_variant;
+    TesterOutcome outcome { false, false, 0, false, std::nullopt };
+
+    auto [timeout, elapsed] = output.get();
+    if(!timeout)
+      per_variant = elapsed / launched;
+
+    // The supervisor is done with the parser state once the future is ready,
+    // but may still stop this run for the records of the other engine. The pid
+    // must not be killed anymore once it is reaped and may be reused.
+    pid_t reaped;
+    size_t finished;
+    std::optional<size_t> stopped;
+    {
+      std::lock_guard<std::mutex> lock(stop_mutex);
+      reaped = pid;
+      pid = -1;
+      exited = true;
+      finished = ended.size();
+      for(auto [variant_success, digest] : ended)
+        outcomes.push_back(TesterOutcome { variant_success, false, 0, false, digest });
+      ended.clear();
+      stopped = stop_variant;
+    }
+    partial.clear(); // Truncated record of a crashed runner
+
+    int status = launcher->Reap(reaped);
+    int result = 1;
+    if(WIFEXITED(status)) {
+      result = WEXITSTATUS(status);
+    } else if(WIFSIGNALED(status)) {
+      outcome.signal = WTERMSIG(status);
+    }
+    outcome.success = !timeout && result == 0;
+    outcome.timeout = timeout;
+
+    if(stopped.has_value()) {
+      // Killed on purpose, the variant it was executing is complete as far
+      // as the comparison is concerned
+      if(outcomes.size() == *stopped)
+        outcomes.push_back(TesterOutcome { true, false, 0, true, std::nullopt });
+      return std::nullopt;
+    }
+
+    if(Done())
+      return per_variant;
+
+    if(finished == 0 && !outcome.timeout && outcome.signal == 0) {
+      // The runner could not start on this module at all, do not retry
+      while(!Done())
+        outcomes.push_back(TesterOutcome { false, false, 0, false, std::nullopt });
+      return std::nullopt;
+    }
+
+    outcomes.push_back(TesterOutcome { false, outcome.timeout, outcome.signal, false, std::nullopt });
+    return std::nullopt;
+  }
+};
 
 char const* memories[] = { "memory/zero.mem",
                            "memory/one.mem", 
@@ -373,248 +1257,740 @@ char const* memories[] = { "memory/zero.mem",
                            "memory/rand2.mem", 
                            "memory/rand3.mem" };
 
-void FuzzingLoop(CommandLineArgument& args) {
-  CorePatternScope corePattern { args.dumpCore };
+// The memory images, each loaded once into a sealed memfd. The runners inherit
+// the descriptors and map the images through /proc/self/fd, so all of them
+// share the same pages instead of reading the files.
+class MemoryImages {
+  std::vector<int> fds;
+  std::vector<std::string> paths;
+
+  static int Share(std::string const& file) {
+    auto image = dfw::MappedFile::Open(file.c_str());
+    if(!image.has_value())
+      return -1;
+
+    // Inherited by the runners, so no close-on-exec
+    int fd = memfd_create("memory-image", MFD_ALLOW_SEALING);
+    if(fd < 0)
+      return -1;
+
+    bool ok = true;
+    for(size_t done = 0; ok && done < image->Size(); ) {
+      ssize_t written = write(fd, image->Data() + done, image->Size() - done);
+      ok = written > 0;
+      done += ok ? written : 0;
+    }
+    ok = ok && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0;
 
-  if(!std::filesystem::exists((char const*)args.outputFolder))
-    std::filesystem::create_directory((char const*)args.outputFolder);
+    // Out of the way of the descriptors installed in the runners
+    int shared = ok ? fcntl(fd, F_DUPFD, MEMORY_IMAGE_FILE_DESCRIPTOR_BASE) : -1;
+    close(fd);
+    return shared;
+  }
 
-  dfw::db::Entities entities { dfw::strjoin(args.outputFolder, "/fuzzer.db") };
-  // Enable creating a core dump
+public:
+  MemoryImages(std::string const& argfolder) {
+    for(auto memory : memories) {
+      std::string file = argfolder + memory;
+      int fd = Share(file);
+      if(fd >= 0) {
+        fds.push_back(fd);
+        paths.push_back("/proc/self/fd/" + std::to_string(fd));
+      } else {
+        // The runners read the file themselves then
+        std::cout << "WARNING: cannot share memory image " << file << std::endl;
+        paths.push_back(file);
+      }
+    }
+  }
 
-  // Generate a new random seed
-  int64_t this_seed;
-  std::mt19937 re(std::time(NULL));
-  this_seed = re();
+  MemoryImages(MemoryImages const&) = delete;
+  MemoryImages& operator=(MemoryImages const&) = delete;
 
-  if(args.reproduceSeed.set) {
-    this_seed = args.reproduceSeed;
+  ~MemoryImages() {
+    for(int fd : fds)
+      close(fd);
   }
-  // Reseed
-  re.seed(this_seed);
 
-  std::string wasm_gen_cmd;
-  std::string argfolder { args.programCommand };
+  // Path of each memory image as seen by the runners
+  std::vector<std::string> const& Paths() const { return paths; }
+};
 
-  auto slash = std::find_if(argfolder.rbegin(), argfolder.rend(), [&] (char a) { return a == '/' ? true : false; });
-  
-  if(slash != argfolder.rend()) {
-    argfolder = std::string { argfolder.begin(), slash.base() };
+// Generated modules by the hash of their content, shared by all lanes. The
+// first module with a hash is copied into the store, named by the hash, so it
+// can be reproduced without generating it again.
+class ModuleStore {
+  std::filesystem::path folder;
+  std::mutex mutex;
+  std::unordered_map<uint64_t, int64_t> runs; // Executions per hash
+
+public:
+  ModuleStore(std::string const& output_folder) : folder(std::filesystem::path(output_folder) / "modules") {
+    std::filesystem::create_directories(folder);
   }
 
-  
-  std::cout << "Argfolder: " << argfolder << std::endl;
-  std::string input_wasm = "/dev/shm/randomized-wasm-";
-  input_wasm += std::to_string(this_seed);
-  {
-    // Build argument
-    std::stringstream ss;
-    ss << argfolder << "random-gen";
-    ss << " -block-size " << args.randomSize;
-    ss << " -seed " << this_seed;
-    ss << " -output " << input_wasm;
-    ss << " -memory /dev/shm/randomized-memory";
-    ss << " > /dev/null";
-    wasm_gen_cmd = ss.str();
+  static std::string HashName(uint64_t hash) {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+    return name;
   }
 
-  // Open process to generate WASM and Memory
-  FILE* wasm_gen_p = popen(wasm_gen_cmd.c_str(), "w");
-  POpenScope wasm_gen_scope(wasm_gen_p);
+  // Hash the module and count an execution of it, unless it already ran
+  // max_runs times. Returns the hash and whether the module should run.
+  std::tuple<uint64_t, bool> Admit(GeneratedModule const& module, int64_t max_runs) {
+    auto file = dfw::MappedFile::Open(module.path.c_str());
+    if(!file.has_value())
+      return { 0, true };
+    auto bytes = file->Bytes().first(std::min(module.size, file->Size()));
+    uint64_t hash = dfw::HashBytes(bytes);
+
+    bool first;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto& count = runs[hash];
+      if(max_runs > 0 && count >= max_runs)
+        return { hash, false };
+      first = count++ == 0;
+    }
 
-  if(wasm_gen_p == NULL) {
-    std::cout << "ERROR OPENING GENERATOR: "
-              << wasm_gen_cmd << std::endl;
-    std::abort();
+    // Also kept from an earlier session
+    auto stored = folder / (HashName(hash) + ".wasm");
+    if(first && !std::filesystem::exists(stored)) {
+      std::ofstream out(stored, std::ios::binary);
+      out.write((char const*)bytes.data(), bytes.size());
+    }
+    return { hash, true };
   }
+};
 
-  int posix_handle = fileno(wasm_gen_p);
-  __gnu_cxx::stdio_filebuf<char> filebuf_out(posix_handle, std::ios::out);
-  std::ostream os(&filebuf_out);
+// Serializes all writes to the database on a single thread
+class DbWriter {
+  dfw::db::Entities& entities;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<std::function<void(dfw::db::Entities&)>> tasks;
+  bool stop { false };
+  std::thread worker;
+
+  void Loop() {
+    size_t written = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+      cond.wait(lock, [this] { return stop || !tasks.empty(); });
+      if(tasks.empty())
+        break; // Stopped and drained
+
+      auto task = std::move(tasks.front());
+      tasks.pop_front();
+
+      lock.unlock();
+      task(entities);
+      if(++written % 100 == 0)
+        entities.Flush(); // Write every 100 records
+      lock.lock();
+    }
+    entities.Flush();
+  }
 
-  InstallSigaction();
+public:
+  DbWriter(dfw::db::Entities& entities) : entities(entities), worker([this] { Loop(); }) { }
 
-  // Store seed ID in DB
-  auto seed = entities.StoreSeedConfig(this_seed, args.randomSize);
-  entities.Flush();
+  ~DbWriter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    cond.notify_all();
+    worker.join();
+  }
 
-  std::cout << "seed: " << this_seed << "\n";
-  for(int i = 0; i < 5000; i++) {
-    std::cout << "step: " << i << "\n";
-    // Loop increment the stepping
-    os << "w" << std::endl;
-    os.flush();
+  void Submit(std::function<void(dfw::db::Entities&)> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    cond.notify_one();
+  }
+};
+
+// A generated module and the memory variants to run it with
+struct StepContext {
+  std::string input_wasm;
+  size_t module_size;
+  int64_t step;
+  std::vector<dfw::RunnerVariant> variants;
+  dfw::DivergenceCounters& divergences; // Of the seed that generated the module
+  quince::serial step_id; // Only accessed by the DbWriter
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  size_t pending;
+
+  StepContext(std::string input_wasm, size_t module_size, int64_t step, 
+              std::vector<dfw::RunnerVariant> variants, dfw::DivergenceCounters& divergences) :
+    input_wasm(std::move(input_wasm)), module_size(module_size), step(step), variants(std::move(variants)),
+    divergences(divergences), pending(this->variants.size()) { }
+
+  void Complete(size_t count) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending -= count;
+    }
+    cond.notify_all();
+  }
 
-    // Sleep for a moment
-    // Need to find a way to get notification back from popen
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+  bool WaitFor(std::chrono::milliseconds duration) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cond.wait_for(lock, duration, [this] { return pending == 0; });
+  }
+};
 
-    auto step = entities.StoreStepping(seed, i);
+struct WorkItem {
+  std::shared_ptr<StepContext> step;
+  size_t memstep;
+};
 
-    for(int i = 0; i < 5; i++) {
-      std::cout << "memstep: " << i;
-      // Inner loop increment the memory
-      
-      // Start two parallel process of V8 and SpiderMonkey
-      std::string v8_args;
-      {
-        // Build argument
-        std::stringstream ss;
-        ss << argfolder << "runner-v8";
-        v8_args = ss.str();
-      }
-      
-      std::string spidermonkey_args;
-      {
-        // Build argument
-        std::stringstream ss;
-        ss << argfolder << "runner-spidermonkey";
-        spidermonkey_args = ss.str();
-      }
+// Pending work of a lane. The owner takes from the front, idle lanes steal
+// from the back.
+class WorkQueue {
+  std::mutex mutex;
+  std::deque<WorkItem> items;
+public:
+  void Push(std::vector<WorkItem> const& new_items) {
+    std::lock_guard<std::mutex> lock(mutex);
+    items.insert(items.end(), new_items.begin(), new_items.end());
+  }
+
+  // Take the items at the front sharing the same module, so they can be
+  // executed by a single runner. If other lanes are idle, their shares of the
+  // items are left at the back for them to steal.
+  std::vector<WorkItem> PopBatch(size_t idle_lanes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<WorkItem> ret;
+    if(items.empty())
+      return ret;
+    auto& front = items.front().step;
+    size_t same = std::find_if(items.begin(), items.end(), 
+                               [&front] (auto& item) { return item.step != front; }) - items.begin();
+    size_t count = same - same * idle_lanes / (idle_lanes + 1);
+    ret.insert(ret.end(), std::make_move_iterator(items.begin()), std::make_move_iterator(items.begin() + count));
+    items.erase(items.begin(), items.begin() + count);
+    return ret;
+  }
+
+  // Take a share of the items at the back sharing the same module, split
+  // evenly among the idle lanes including the thief
+  std::vector<WorkItem> Steal(size_t idle_lanes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<WorkItem> ret;
+    if(items.empty())
+      return ret;
+    auto& back = items.back().step;
+    size_t same = std::find_if(items.rbegin(), items.rend(), 
+                               [&back] (auto& item) { return item.step != back; }) - items.rbegin();
+    size_t count = (same + idle_lanes - 1) / idle_lanes;
+    ret.insert(ret.end(), std::make_move_iterator(items.end() - count), std::make_move_iterator(items.end()));
+    items.erase(items.end() - count, items.end());
+    return ret;
+  }
+};
+
+// Matches the call records of both engines pairwise as they arrive and
+// classifies every pair right away, so only the records by which one engine is
+// ahead of the other are kept in memory. Only the classified pairs and the
+// calls after the first divergence are stored, unless all of them are requested.
+// Once the engines diverged for the grace number of calls, the divergence
+// callback is invoked to stop both runners.
+class LogComparator {
+public:
+  enum Side : size_t { V8 = 0, SpiderMonkey = 1 };
+
+  // Rows of a memstep, only accessed by the DbWriter
+  struct Ids {
+    quince::serial memstep;
+    quince::serial v8_id;
+    quince::serial sm_id;
+    int64_t timestamp;
+  };
+
+private:
+  struct Variant {
+    std::shared_ptr<Ids> ids;
+    std::deque<LoggedCall> pending[2];
+    size_t received[2] { 0, 0 };
+    int64_t sequence { 0 };
+    std::optional<int64_t> diverged_at;
+    bool stopped { false };
+    bool memory_differs { false }; // The memory roots of the last pair differ
+  };
+
+  DbWriter& writer;
+  dfw::DivergenceCounters& counters;
+  int64_t grace;
+  bool store_all;
+  std::mutex mutex;
+  std::vector<Variant> variants;
+  std::function<void(size_t)> on_divergence;
+
+  // Classify a decoded pair and store it if needed, called with the mutex held
+  void Classify(size_t variant, int64_t sequence, dfw::CallRecord v8_exec, dfw::CallRecord moz_exec) {
+    auto& v = variants[variant];
+    auto category = dfw::ClassifyCall(v8_exec, moz_exec);
+    if(category.has_value()) {
+      counters.Add(*category);
+      if(!v.diverged_at.has_value() && !dfw::IsBenign(*category))
+        v.diverged_at = sequence;
+    }
+
+    if(store_all || category.has_value() || v.diverged_at.has_value()) {
+      writer.Submit([ids = v.ids, sequence, category, 
+                     v8_exec = std::move(v8_exec), moz_exec = std::move(moz_exec)] (dfw::db::Entities& entities) {
+        StoreCallPair(entities, ids->memstep, ids->v8_id, ids->sm_id, sequence, v8_exec, moz_exec);
+        if(category.has_value())
+          entities.StoreDivergence(dfw::db::Divergence { {}, ids->memstep, sequence, dfw::DivergenceName(*category) });
+      });
+    }
+  }
+
+public:
+  LogComparator(DbWriter& writer, std::vector<WorkItem> const& batch, int64_t grace, bool store_all) : 
+      writer(writer), counters(batch.front().step->divergences), grace(grace), store_all(store_all), 
+      variants(batch.size()) {
+    for(size_t i = 0; i < batch.size(); i++) {
+      auto ids = std::make_shared<Ids>();
+      ids->timestamp = std::time(NULL);
+      variants[i].ids = ids;
+
+      // The test cases are completed once the runners finished
+      writer.Submit([ids, step = batch[i].step, memstep_no = batch[i].memstep] (dfw::db::Entities& entities) {
+        ids->memstep = entities.StoreMemoryStepping(step->step_id, memstep_no, 
+                                                    step->variants[memstep_no].arg_seed);
+        ids->v8_id = entities.StoreTestCase(ids->memstep, (int)dfw::db::Entities::ID::V8, 
+                                            ids->timestamp, false, false, 0);
+        ids->sm_id = entities.StoreTestCase(ids->memstep, (int)dfw::db::Entities::ID::SpiderMonkey, 
+                                            ids->timestamp, false, false, 0);
+      });
+    }
+  }
 
-      std::string mem_args;
-      {
-        // Build argument
-        std::stringstream ss;
-        ss << argfolder << memories[i];
-        mem_args = ss.str();
+  void Push(Side side, size_t variant, LoggedCall record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(variant >= variants.size())
+      return;
+
+    auto& v = variants[variant];
+    v.received[side]++;
+    v.pending[side].push_back(std::move(record));
+    if(v.pending[V8].empty() || v.pending[SpiderMonkey].empty())
+      return;
+
+    int64_t sequence = v.sequence++;
+    auto& v8_call = v.pending[V8].front();
+    auto& moz_call = v.pending[SpiderMonkey].front();
+
+    // Equal digests are equal calls, which are dropped without decoding them.
+    // The digests cover the memory roots, so equal calls leave equal memories.
+    bool same = v8_call.digest == moz_call.digest;
+    if(same)
+      v.memory_differs = false;
+    if(!same || store_all || v.diverged_at.has_value()) {
+      auto v8_exec = v8_call.Decode();
+      auto moz_exec = moz_call.Decode();
+      if(v8_exec != nullptr && moz_exec != nullptr) {
+        v.memory_differs = v8_exec->memory_root != moz_exec->memory_root;
+        Classify(variant, sequence, std::move(*v8_exec), std::move(*moz_exec));
       }
-      
-      std::cout << " * runner start * ";
-      std::cout.flush();
-
-      // Worker runner
-      auto runner = [] (std::string args, std::string input_wasm, std::string mem_args, std::string arg_seed, std::string name) {
-        //FILE* process = popen(args.c_str(), "r");
-        auto [pid, pipeno] = SpawnTester(args, input_wasm, mem_args, arg_seed);
-        FilenoScope pipeno_scope(pipeno);
-
-        //int posix_handle = fileno(process);
-        __gnu_cxx::stdio_filebuf<char> filebuf(pipeno, std::ios::in);
-        std::istream is(&filebuf);
-
-        std::atomic_bool terminate_signal(false);
-
-        // Split again inside an async task
-        using TaskFunc = std::tuple<std::string, bool>(void);
-        std::packaged_task<TaskFunc> read_task ([&is, &name, &terminate_signal] {
-          char buffer[4096]; // Eat the buffer until EOF
-
-          std::memset(buffer, 0, sizeof(buffer));
-          std::stringstream ss;
-          std::string line;
-
-          bool timeout = false;
-          
-          while (!is.eof()) {
-            if(terminate_signal.load()) {
-              std::cout << " * receive timeout signal * ";
-              ss << "PROCESS TIMEOUT\n";
-              timeout = true;
-              break;
-            }
-              
-            auto read = is.readsome(buffer, sizeof(buffer));
-            if(read != 0) {
-              ss.write(buffer, read);
-            } else {
-              is.peek(); // Trigger read to EOF
-              std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            }
-          }
-          
-          std::cout << " * finished processing " << name << " * ";
-          return std::make_tuple(ss.str(), timeout);
-        });
+    }
+    v.pending[V8].pop_front();
+    v.pending[SpiderMonkey].pop_front();
+
+    // The stored calls up to here hold the state of both engines at the divergence
+    if(grace >= 0 && !v.stopped && v.diverged_at.has_value() && sequence - *v.diverged_at >= grace) {
+      v.stopped = true;
+      if(on_divergence)
+        on_divergence(variant);
+    }
+  }
+
+  // Called with the variant from the thread pushing the records
+  void OnDivergence(std::function<void(size_t)> callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    on_divergence = std::move(callback);
+  }
+
+  std::optional<int64_t> DivergedAt(size_t variant) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return variants[variant].diverged_at;
+  }
 
-        auto read_future = read_task.get_future();
-        std::thread t(std::move(read_task));
-        t.detach();
-        auto future_state = read_future.wait_for(std::chrono::seconds(10));
+  // Whether the memories of both engines differ after the last compared call
+  bool MemoryDiffers(size_t variant) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return variants[variant].memory_differs;
+  }
 
-        if(future_state != std::future_status::ready) {
-          // Timeout, force close
-          std::cout << " * process timeout, closing... * ";
-          terminate_signal.store(true);
-          std::cout.flush();
+  // Drop the records the other engine never reached, returns the number of
+  // records received from each engine
+  std::tuple<size_t, size_t> Close(size_t variant) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& v = variants[variant];
+    v.pending[V8].clear();
+    v.pending[SpiderMonkey].clear();
+    return { v.received[V8], v.received[SpiderMonkey] };
+  }
 
-          // Kill child process
-          kill(pid, SIGKILL);
-          waitpid(pid, NULL, 0);
-          auto [log, timeout] = read_future.get();
-          return std::make_tuple(false, std::move(log), true, 0);
+  std::shared_ptr<Ids> const& IdsOf(size_t variant) const { return variants[variant].ids; }
+};
 
-        } else {
-          // Check child process return status
-          int status;
-          int result;
-          waitpid(pid, &status, 0);
-          auto [log, timeout] = read_future.get();
-          int signal = 0;
-          if(WIFEXITED(status)) {
-            result = WEXITSTATUS(status);
-          } else if(WIFSIGNALED(status)) {
-            signal = WTERMSIG(status);
-          }
+// An independent fuzzing campaign with its own seed, generator, runners
+// and /dev/shm files
+class FuzzingLane {
+  CommandLineArgument& args;
+  std::string const& argfolder;
+  MemoryImages const& images;
+  ModuleStore& modules;
+  DbWriter& writer;
+  ChildSupervisor& supervisor;
+  TimeoutPolicy& timeouts;
+  std::vector<std::unique_ptr<FuzzingLane>> const& lanes;
+
+  size_t lane_no;
+  int64_t lane_seed;
+  std::mt19937 re;
+  std::shared_ptr<quince::serial> seed_id; // Only accessed by the DbWriter
+
+  std::unique_ptr<TesterLauncher> v8_launcher;
+  std::unique_ptr<TesterLauncher> spidermonkey_launcher;
+
+  // Result rings of the runners when the ring transport is selected
+  std::optional<dfw::ResultRing> v8_ring;
+  std::optional<dfw::ResultRing> spidermonkey_ring;
 
-          //if(log.rfind("ERROR", 0) == 0) result = 1; // This is error
-          
-          return std::make_tuple(result == 0, std::move(log), timeout, signal);
+public:
+  WorkQueue queue;
+  std::atomic<bool> idle { false }; // Nothing to execute until its own step is finished
+  dfw::DivergenceCounters divergences; // Of the modules generated from the lane seed
+
+  FuzzingLane(CommandLineArgument& args, std::string const& argfolder, MemoryImages const& images, ModuleStore& modules, DbWriter& writer,
+              ChildSupervisor& supervisor, TimeoutPolicy& timeouts,
+              std::vector<std::unique_ptr<FuzzingLane>> const& lanes,
+              size_t lane_no, int64_t lane_seed) :
+      args(args), argfolder(argfolder), images(images), modules(modules), writer(writer), supervisor(supervisor), timeouts(timeouts), 
+      lanes(lanes), 
+      lane_no(lane_no), lane_seed(lane_seed), re(lane_seed),
+      seed_id(std::make_shared<quince::serial>()) { }
+
+  void Execute(std::vector<WorkItem> const& batch) {
+    // Each engine compiles the module once and runs every memory variant
+    auto& step = batch.front().step;
+    dfw::RunnerJob job { step->input_wasm, {}, 50 };
+    for(auto& item : batch)
+      job.variants.push_back(step->variants[item.memstep]);
+
+    // Both engines run concurrently, their output is compared as it arrives
+    LogComparator comparator { writer, batch, args.divergenceGrace, args.storeAll };
+    auto protocol = *dfw::ParseResultProtocol(args.protocol);
+    VariantRun v8_run { v8_launcher.get(), job, "v8", protocol, 
+                        v8_ring.has_value() ? &*v8_ring : nullptr,
+                        [&comparator] (size_t variant, LoggedCall record) {
+                          comparator.Push(LogComparator::V8, variant, std::move(record));
+                        } };
+    VariantRun spidermonkey_run { spidermonkey_launcher.get(), job, "spidermonkey", protocol,
+                                  spidermonkey_ring.has_value() ? &*spidermonkey_ring : nullptr,
+                                  [&comparator] (size_t variant, LoggedCall record) {
+                                    comparator.Push(LogComparator::SpiderMonkey, variant, std::move(record));
+                                  } };
+    VariantRun* runs[] = { &v8_run, &spidermonkey_run };
+
+    // Later calls of a diverged variant tell nothing new, move on to the next one
+    comparator.OnDivergence([&v8_run, &spidermonkey_run] (size_t variant) {
+      v8_run.Stop(variant);
+      spidermonkey_run.Stop(variant);
+    });
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    auto notify = [&mutex, &cond] {
+      std::lock_guard<std::mutex> lock(mutex);
+      cond.notify_all();
+    };
+
+    while(!v8_run.Done() || !spidermonkey_run.Done()) {
+      for(auto run : runs)
+        run->Start(supervisor, timeouts.Initial(run->Name(), step->module_size, run->Remaining()), notify);
+
+      // Whoever finishes first bounds the deadline of the other engine
+      bool bounded = false;
+      while(std::any_of(std::begin(runs), std::end(runs), [] (auto run) { return run->Running(); })) {
+        VariantRun* ready = nullptr;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cond.wait(lock, [&] { 
+            for(auto run : runs) 
+              if(run->Running() && run->Ready()) { ready = run; return true; }
+            return false; 
+          });
         }
+
+        auto per_variant = ready->Finish();
+        if(!per_variant.has_value())
+          continue;
+
+        timeouts.Record(ready->Name(), step->module_size, *per_variant);
+        if(bounded) 
+          continue;
+        bounded = true;
+        for(auto run : runs)
+          run->Shorten(supervisor, timeouts.Relative(*per_variant, run->Remaining()));
+      }
+    }
+
+    for(size_t i = 0; i < batch.size(); i++) {
+      auto [v8_records, spidermonkey_records] = comparator.Close(i);
+      auto& v8_outcome = v8_run.outcomes[i];
+      auto& spidermonkey_outcome = spidermonkey_run.outcomes[i];
+      auto category = dfw::ClassifyOutcome(v8_outcome.timeout, v8_outcome.signal, 
+                                           spidermonkey_outcome.timeout, spidermonkey_outcome.signal);
+      if(category.has_value())
+        step->divergences.Add(*category);
+      bool memory_differs = comparator.MemoryDiffers(i);
+      if(memory_differs)
+        step->divergences.Add(dfw::Divergence::MemoryStateMismatch);
+
+      writer.Submit([step, memstep_no = batch[i].memstep, lane_no = this->lane_no, 
+                     ids = comparator.IdsOf(i), v8_records = v8_records, 
+                     spidermonkey_records = spidermonkey_records,
+                     diverged_at = comparator.DivergedAt(i), category, memory_differs,
+                     v8_outcome = v8_outcome, 
+                     spidermonkey_outcome = spidermonkey_outcome] (dfw::db::Entities& entities) {
+        std::cout << "lane: " << lane_no << " step: " << step->step << " memstep: " << memstep_no;
         
-      };
+        auto [v8_success, v8_timeout, v8_signal, v8_stopped, v8_digest] = v8_outcome;
+        auto [spidermonkey_success, spidermonkey_timeout, spidermonkey_signal, spidermonkey_stopped, 
+              spidermonkey_digest] = spidermonkey_outcome;
 
-      int64_t arg_seed = re();
+        if(!v8_success) {
+          std::cout << " v8 failed";
+        }
+        
+        if(!spidermonkey_success) {
+          std::cout << " spidermonkey failed";
+        }
 
-      // Parallelize
-      auto v8_task = std::async(std::launch::async, runner, v8_args, input_wasm, mem_args, std::to_string(arg_seed), "v8");
-      auto spidermonkey_task = std::async(std::launch::async, runner, spidermonkey_args, input_wasm, mem_args, std::to_string(arg_seed), "spidermonkey");
+        if(v8_records == 0)
+          std::cout << " v8 empty log";
+        if(spidermonkey_records == 0)
+          std::cout << " moz empty log";
+
+        if(v8_digest.has_value() && v8_digest == spidermonkey_digest)
+          std::cout << " identical";
+        if(diverged_at.has_value())
+          std::cout << " diverged at call " << *diverged_at;
+        if(v8_stopped || spidermonkey_stopped)
+          std::cout << " stopped early";
+
+        if(category.has_value()) {
+          std::cout << " " << dfw::DivergenceName(*category);
+          entities.StoreDivergence(dfw::db::Divergence { {}, ids->memstep, boost::none, dfw::DivergenceName(*category) });
+        }
+        if(memory_differs) {
+          auto name = dfw::DivergenceName(dfw::Divergence::MemoryStateMismatch);
+          std::cout << " " << name;
+          entities.StoreDivergence(dfw::db::Divergence { {}, ids->memstep, boost::none, name });
+        }
 
-      auto [v8_success, 
-            v8_log, 
-            v8_timeout, 
-            v8_signal] = v8_task.get();
+        entities.UpdateTestCase(ids->v8_id, ids->memstep, (int)dfw::db::Entities::ID::V8, 
+                                ids->timestamp, v8_success, v8_timeout, v8_signal);
 
-      
-      auto [spidermonkey_success, 
-            spidermonkey_log, 
-            spidermonkey_timeout, 
-            spidermonkey_signal] = spidermonkey_task.get();
-      
-      if(!v8_success) {
-        std::cout << " v8 failed";
-      }
-      
-      if(!spidermonkey_success) {
-        std::cout << " spidermonkey failed";
-      }
+        entities.UpdateTestCase(ids->sm_id, ids->memstep, (int)dfw::db::Entities::ID::SpiderMonkey, 
+                                ids->timestamp, spidermonkey_success, spidermonkey_timeout, spidermonkey_signal);
 
-      auto memstep = entities.StoreMemoryStepping(step, i, arg_seed);
-      
-      auto v8_id = entities.StoreTestCase(memstep, (int)dfw::db::Entities::ID::V8, 
-                                          std::time(NULL), v8_success, v8_timeout, v8_signal);
+        std::cout << std::endl;
+      });
+    }
 
-      auto sm_id = entities.StoreTestCase(memstep, (int)dfw::db::Entities::ID::SpiderMonkey, 
-                                          std::time(NULL), spidermonkey_success, spidermonkey_timeout, spidermonkey_signal);
-      
-      CompareLogs(v8_log, spidermonkey_log, entities, memstep, v8_id, sm_id);
+    step->Complete(batch.size());
+  }
+
+  // Number of the other lanes waiting for work
+  size_t IdleLanes() const {
+    return std::count_if(lanes.begin(), lanes.end(), 
+                         [this] (auto& lane) { return lane.get() != this && lane->idle; });
+  }
 
-      std::cout << std::endl;
+  std::vector<WorkItem> StealWork() {
+    // Start from the next lane so the victims are spread evenly
+    for(size_t i = 1; i < lanes.size(); i++) {
+      auto& victim = lanes[(lane_no + i) % lanes.size()];
+      if(auto batch = victim->queue.Steal(IdleLanes() + 1); !batch.empty())
+        return batch;
+    }
+    return {};
+  }
 
-      if(global_exit) {
-        std::cout << "Exitting..." << std::endl;
-        goto END;
+  void Run() {
+    std::string input_wasm = "/dev/shm/randomized-wasm-";
+    input_wasm += std::to_string(lane_seed);
+    std::string input_memory = "/dev/shm/randomized-memory-";
+    input_memory += std::to_string(lane_seed);
+
+    // Open process to generate WASM and Memory
+    GeneratorPipeline generator { argfolder, (uint64_t)lane_seed, args.randomSize, 
+                                  input_wasm, input_memory, args.rng.value, args.prefetch };
+
+    // Runner processes for both engines
+    v8_launcher = MakeLauncher(args, argfolder + "runner-v8");
+    spidermonkey_launcher = MakeLauncher(args, argfolder + "runner-spidermonkey");
+
+    if(std::strcmp(args.transport, "ring") == 0) {
+      v8_ring = dfw::ResultRing::Create(args.ringSize * 1024);
+      spidermonkey_ring = dfw::ResultRing::Create(args.ringSize * 1024);
+      if(!v8_ring.has_value() || !spidermonkey_ring.has_value()) {
+        std::cout << "lane: " << lane_no << " cannot create the result rings, using pipes\n";
+        v8_ring.reset();
+        spidermonkey_ring.reset();
       }
+    }
 
-      if(i % 100 == 0 && i != 0)
-        entities.Flush(); // Write every 100 records
+    // Store seed ID in DB
+    writer.Submit([seed_id = this->seed_id, lane_seed = this->lane_seed, 
+                   block_size = args.randomSize.value] (dfw::db::Entities& entities) {
+      *seed_id = entities.StoreSeedConfig(lane_seed, block_size);
+    });
+
+    std::cout << "lane: " << lane_no << " seed: " << lane_seed << "\n";
+    for(int i = 0; i < 5000 && !global_exit; i++) {
+      std::cout << "lane: " << lane_no << " step: " << i << "\n";
+      // Loop increment the stepping
+      auto module = generator.Next();
+      if(!module.has_value()) {
+        std::cout << "ERROR: generator of lane " << lane_no << " exited" << std::endl;
+        break;
+      }
+      std::cout << "lane: " << lane_no << " module: " << module->size << " bytes, " 
+                << module->memory_pages << " pages\n";
+
+      // Drawn for every step, so the seeds of a lane do not depend on which
+      // lane generated a module first
+      std::vector<dfw::RunnerVariant> variants;
+      for(auto& memory : images.Paths()) {
+        int64_t arg_seed = re();
+        variants.push_back(dfw::RunnerVariant { memory, arg_seed });
+      }
+
+      // Modules generated before are only recorded, up to the run limit
+      auto [module_hash, admitted] = modules.Admit(*module, args.maxModuleRuns);
+      auto stored_module = dfw::db::SteppingModule { {}, {}, ModuleStore::HashName(module_hash), 
+                                                     (int64_t)module->size, admitted };
+      if(!admitted) {
+        std::cout << "lane: " << lane_no << " duplicate module: " << stored_module.hash << "\n";
+        writer.Submit([seed_id = this->seed_id, step = i, stored_module] (dfw::db::Entities& entities) mutable {
+          stored_module.stepping_id = entities.StoreStepping(*seed_id, step);
+          entities.StoreSteppingModule(stored_module);
+        });
+        generator.Release(*module);
+        continue;
+      }
+
+      auto step = std::make_shared<StepContext>(module->path, module->size, i, std::move(variants), divergences);
+      writer.Submit([seed_id = this->seed_id, step, stored_module] (dfw::db::Entities& entities) mutable {
+        step->step_id = entities.StoreStepping(*seed_id, step->step);
+        stored_module.stepping_id = step->step_id;
+        entities.StoreSteppingModule(stored_module);
+      });
+
+      std::vector<WorkItem> items;
+      for(size_t m = 0; m < step->variants.size(); m++)
+        items.push_back(WorkItem { step, m });
+      queue.Push(items);
+
+      // The module file is overwritten by the next step, so wait until every
+      // memstep is finished, helping the other lanes in the meantime
+      while(!step->WaitFor(std::chrono::milliseconds(0))) {
+        auto batch = queue.PopBatch(IdleLanes());
+        if(batch.empty())
+          batch = StealWork();
+
+        idle = batch.empty();
+        if(batch.empty())
+          step->WaitFor(std::chrono::milliseconds(10));
+        else
+          Execute(batch);
+      }
+      idle = false;
+
+      generator.Release(*module);
     }
+
+    std::cout << "lane: " << lane_no << " seed: " << lane_seed << " divergences: ";
+    divergences.Print(std::cout);
+    std::cout << std::endl;
+  }
+};
+
+void FuzzingLoop(CommandLineArgument& args) {
+  CorePatternScope corePattern { args.dumpCore };
+
+  if(!std::filesystem::exists((char const*)args.outputFolder))
+    std::filesystem::create_directory((char const*)args.outputFolder);
+
+  dfw::db::Entities entities { dfw::strjoin(args.outputFolder, "/fuzzer.db") };
+  // Enable creating a core dump
+
+  // Generate a new random seed
+  int64_t this_seed;
+  std::mt19937 re(std::time(NULL));
+  this_seed = re();
+
+  if(args.reproduceSeed.set) {
+    this_seed = args.reproduceSeed;
+  }
+
+  std::string argfolder { args.programCommand };
+
+  auto slash = std::find_if(argfolder.rbegin(), argfolder.rend(), [&] (char a) { return a == '/' ? true : false; });
+  
+  if(slash != argfolder.rend()) {
+    argfolder = std::string { argfolder.begin(), slash.base() };
   }
+  
+  std::cout << "Argfolder: " << argfolder << std::endl;
 
-END:
-  entities.Flush();
-  os << "q" << std::endl;
-  os.flush();
+  InstallSigaction();
+
+  {
+    // Before the launchers start, so every runner inherits the images
+    MemoryImages images { argfolder };
+    ModuleStore modules { (char const*)args.outputFolder };
+    DbWriter writer { entities };
+    ChildSupervisor supervisor;
+    TimeoutPolicy timeouts { args.timeoutMultiplier, args.timeoutFloor, args.timeoutCeiling };
+
+    // Lane n fuzzes seed + n, so every lane can be reproduced on its own
+    std::vector<std::unique_ptr<FuzzingLane>> lanes;
+    size_t lane_count = std::max<uint64_t>(args.jobs.value, 1);
+    for(size_t n = 0; n < lane_count; n++)
+      lanes.push_back(std::make_unique<FuzzingLane>(args, argfolder, images, modules, writer, supervisor, timeouts, lanes, n, this_seed + n));
+
+    std::vector<std::thread> threads;
+    for(auto& lane : lanes)
+      threads.emplace_back([&lane] { lane->Run(); });
+
+    for(auto& thread : threads)
+      thread.join();
+
+    // Stolen work counts for the seed of its module, so the lanes only add up here
+    dfw::DivergenceCounters total;
+    for(auto& lane : lanes)
+      total += lane->divergences;
+    std::cout << "divergences: ";
+    total.Print(std::cout);
+    std::cout << std::endl;
+
+    if(global_exit)
+      std::cout << "Exitting..." << std::endl;
+  }
+  
   return;
 }
 
@@ -627,6 +2003,21 @@ void Reproduce(CommandLineArgument& args) {
 int main(int argc, char const* argv[]) {
 
   CommandLineArgument args { argc, argv };
+
+  if(!dfw::ParseResultProtocol(args.protocol).has_value()) {
+    std::cerr << "Unknown result protocol, use json or binary." << std::endl;
+    return 1;
+  }
+
+  if(!dfw::ParseDirtyTracking(args.dirtyTracking).has_value()) {
+    std::cerr << "Unknown dirty tracking, use off, protect or soft-dirty." << std::endl;
+    return 1;
+  }
+
+  if(std::strcmp(args.rng, "philox") != 0 && std::strcmp(args.rng, "mt19937") != 0) {
+    std::cerr << "Unknown random generator, use philox or mt19937." << std::endl;
+    return 1;
+  }
   
   if(!args.reproduce)
     FuzzingLoop(args);
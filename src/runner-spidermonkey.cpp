@@ -1,5 +1,6 @@
 #include "jsapi.h"
 #include "jsapi-ext.h"
+#include "jsfriendapi.h"
 #include "js/Initialization.h"
 #include "js/CompilationAndEvaluation.h"
 #include "js/SourceText.h"
@@ -10,6 +11,7 @@
 #include <memory>
 
 #include "runner-common.h"
+#include "memory-diff.h"
 
 namespace {
   class RunnerSpiderMonkey {
@@ -25,14 +27,16 @@ namespace {
     RunnerSpiderMonkey(JSContext* context) : context(context) { }
 
     bool InitializeModule(dfw::FuzzerRunnerCLArgs args) {
-      auto inputInstruction = dfw::OpenInput(args.input);
-      this->compiled_wasm = js::ext::CompileWasmBytes(context, inputInstruction.data(), 
-                                                      inputInstruction.size());
+      auto inputInstruction = dfw::MappedFile::Open(args.input);
+      if(!inputInstruction.has_value())
+        return false;
+      this->compiled_wasm = js::ext::CompileWasmBytes(context, inputInstruction->Data(), 
+                                                      inputInstruction->Size());
       
       if(this->compiled_wasm == nullptr)
         return false;
 
-      // Fill reflection information
+      // Fill reflection information, the handles are indices into it
       for(auto& func : this->compiled_wasm->functions()) {
         dfw::FunctionInfo info;
         info.function_name = func.name;
@@ -57,10 +61,22 @@ namespace {
       return true;
     }
 
-    std::optional<std::vector<uint8_t>> DumpFunction(std::string const& name) {
-      auto func = (*this->compiled_wasm)[name];
-      if(func)
-        return std::make_optional(func->instructions);
+    void TeardownModule() {
+      // Release the module, its instance and the imports
+      this->compiled_wasm.reset();
+      this->functions.clear();
+      this->globals.clear();
+    }
+
+    bool RunIsolated(std::function<bool()> const& job) {
+      // Values are rooted on the stack, nothing to release here
+      return job();
+    }
+
+    std::optional<std::vector<uint8_t>> DumpFunction(dfw::FunctionHandle handle) {
+      auto& wasm_functions = this->compiled_wasm->functions();
+      if(handle < wasm_functions.size())
+        return std::make_optional(wasm_functions[handle].instructions);
       else
         return std::nullopt;
     }
@@ -79,11 +95,7 @@ namespace {
       // and the remainder will be undefined
       // If source is bigger than WASM memory, only fill to the available WASM memory and the
       // remainder is discarded
-      auto buffer = wasmMem.buffer;
-      for(int i = 0; i < len && i < wasmMem.length; ++i) {
-        buffer[i] = source[i];
-      }
-        
+      std::memcpy(wasmMem.buffer, source, std::min(len, wasmMem.length));
 
       return true;
     }
@@ -93,44 +105,48 @@ namespace {
       return (uintptr_t)wasmMem.buffer;
     }
 
+    size_t GetWasmMemorySize() {
+      return this->compiled_wasm->GetWasmMemory().length;
+    }
+
     bool InitializeExecution() {
       return this->compiled_wasm->InstantiateWasm(this->context);
     }
 
     
 
+    JS::Value MarshallArg(dfw::JSValue const& arg) {
+      switch(arg.type) {
+        case dfw::WasmType::I32: {
+          //std::cout << "i32: " << arg.i32 << " ";
+          //dfw::PrintHexRepresentation(arg.i32);
+          return JS::Int32Value(arg.i32);
+        }
+        case dfw::WasmType::I64: {
+          //std::cout << "i64: " << arg.i64 << " ";
+          //dfw::PrintHexRepresentation(arg.i64);
+          return js::ext::CreateBigIntValue(this->context, arg.i64);
+        }
+        case dfw::WasmType::F32: {
+          double d = arg.f32; // Implicit conversion first
+          //std::cout << "f32: " << arg.f32 << " ";
+          //dfw::PrintHexRepresentation(d);
+          return JS::DoubleValue(d);
+        }
+        case dfw::WasmType::F64: {
+          //std::cout << "f64: " << arg.f64 << " ";
+          //dfw::PrintHexRepresentation(arg.f64);
+          return JS::DoubleValue(arg.f64);
+        }
+        default:
+          return JS::UndefinedValue();
+      }
+    }
+
     void MarshallArgs(std::vector<JS::Value>& ret, std::vector<dfw::JSValue> const& args) {
       for(auto& arg : args) {
-        switch(arg.type) {
-          case dfw::WasmType::I32: {
-            //std::cout << "i32: " << arg.i32 << " ";
-            //dfw::PrintHexRepresentation(arg.i32);
-            ret.emplace_back(JS::Int32Value(arg.i32));
-            break;
-          }
-          case dfw::WasmType::I64: {
-            //std::cout << "i64: " << arg.i64 << " ";
-            //dfw::PrintHexRepresentation(arg.i64);
-            ret.emplace_back(js::ext::CreateBigIntValue(this->context, arg.i64));
-            break;
-          }
-          case dfw::WasmType::F32: {
-            double d = arg.f32; // Implicit conversion first
-            //std::cout << "f32: " << arg.f32 << " ";
-            //dfw::PrintHexRepresentation(d);
-            ret.emplace_back(JS::DoubleValue(d));
-            break;
-          }
-          case dfw::WasmType::F64: {
-            //std::cout << "f64: " << arg.f64 << " ";
-            //dfw::PrintHexRepresentation(arg.f64);
-            ret.emplace_back(JS::DoubleValue(arg.f64));
-            break;
-          }
-          default:
-            break;
-        }
-        //std::cout << std::endl;
+        if(arg.type != dfw::WasmType::Void)
+          ret.emplace_back(MarshallArg(arg));
       }
     }
 
@@ -157,7 +173,7 @@ namespace {
       return ret;
     }
 
-    std::tuple<std::optional<dfw::JSValue>, uint64_t> InvokeFunction(std::string const& name, std::vector<dfw::JSValue> const& args) {
+    std::tuple<std::optional<dfw::JSValue>, uint64_t> InvokeFunction(dfw::FunctionHandle handle, std::vector<dfw::JSValue> const& args) {
       
       
       std::vector<JS::Value> callStack;
@@ -165,13 +181,39 @@ namespace {
       callStack.emplace_back(); // MAGIC (empty)
       MarshallArgs(callStack, args);
       std::cout.flush();
-      auto [invokeRes, elapsed] = (*compiled_wasm)[name]->Invoke(context, callStack);
+      auto [invokeRes, elapsed] = compiled_wasm->functions()[handle].Invoke(context, callStack);
       
       if(!invokeRes)
         return {std::nullopt, elapsed};
       else
         return {std::optional<dfw::JSValue> { MarshallValue(callStack[0]) }, elapsed };
     }
+
+    void InvokeBatch(dfw::BatchCall const* calls, size_t count, uint64_t const* args, dfw::BatchResult* results,
+                     std::function<void(size_t)> const& after_call) {
+      auto& wasm_functions = this->compiled_wasm->functions();
+
+      // The call stack keeps its capacity across the calls
+      std::vector<JS::Value> callStack;
+      for(size_t i = 0; i < count; ++i) {
+        auto& params = functions[calls[i].function].parameters;
+        callStack.clear();
+        callStack.emplace_back(); // Return value
+        callStack.emplace_back(); // MAGIC (empty)
+        for(size_t p = 0; p < params.size(); ++p)
+          callStack.push_back(MarshallArg(dfw::UnpackArg(params[p], args[calls[i].first_arg + p])));
+
+        auto [invokeRes, elapsed] = wasm_functions[calls[i].function].Invoke(context, callStack);
+        auto& res = results[i];
+        res.elapsed = elapsed;
+        res.success = invokeRes;
+        if(invokeRes)
+          res.result = MarshallValue(callStack[0]);
+        else
+          res.result.type = dfw::WasmType::Void;
+        after_call(i);
+      }
+    }
     std::vector<dfw::FunctionInfo> const& Functions() const { return functions; }
 
     ~RunnerSpiderMonkey() {
@@ -223,16 +265,20 @@ namespace {
       return ret;
     }
 
-    std::vector<dfw::MemoryDiff> CompareInternalMemory(std::vector<uint8_t>& buffer) {
+    // The ext API keys the global imports by name, the slots are in the order of globals
+    void ReadAllGlobals(std::span<dfw::JSValue> values) {
+      for(size_t g = 0; g < globals.size() && g < values.size(); ++g)
+        values[g] = GetGlobal(globals[g].global_name);
+    }
+
+    void WriteAllGlobals(std::span<dfw::JSValue const> values) {
+      for(size_t g = 0; g < globals.size() && g < values.size(); ++g)
+        SetGlobal(globals[g].global_name, values[g]);
+    }
+
+    std::vector<dfw::MemoryRange> CompareInternalMemory(std::span<uint8_t> buffer) {
       auto ref = this->compiled_wasm->GetWasmMemory();
-      std::vector<dfw::MemoryDiff> ret;
-      for(uint32_t i = 0; i < std::min(ref.length, buffer.size()); ++i) {
-        if(buffer[i] != ref.buffer[i]) {
-          ret.emplace_back(i, buffer[i], ref.buffer[i]);
-          buffer[i] = ref.buffer[i]; // Update the buffer
-        }
-      }
-      return ret;
+      return dfw::DiffMemory(buffer, (uint8_t const*)ref.buffer, ref.length);
     }
   };
 }
@@ -248,6 +294,11 @@ static JSClass global_class = {
 int main(int argc, const char *argv[])
 {
   int ret = 0;
+
+  // Helper threads do not survive fork(), run everything on the main thread
+  if(dfw::ForkSafeEngineRequired(argc, argv))
+    js::DisableExtraThreads();
+
   JS_Init();
 
   JSContext *cx = JS_NewContext(8L * 1024 * 1024);
@@ -11,66 +11,75 @@
 #include <chrono>
 
 #include "runner-common.h"
+#include "memory-diff.h"
 
 class RunnerV8 {
 private:
   v8::Isolate* isolate;
   v8::Local<v8::Context>& context;
   v8::ext::CompiledWasm compiled_wasm;
-  mutable std::vector<dfw::FunctionInfo> functions;
+  std::vector<dfw::FunctionInfo> functions;
   std::vector<dfw::GlobalInfo> globals;
 
   dfw::JSValue MarshallValue(v8::Local<v8::Value> const& ref);
+  v8::Local<v8::Value> MarshallArg(dfw::JSValue const& arg);
   std::vector<v8::Local<v8::Value>> MarshallArgs(std::vector<dfw::JSValue> const& args);
 public:
   RunnerV8(v8::Isolate* isolate, v8::Local<v8::Context>& context) :
     isolate(isolate), context(context) { }
 
   bool InitializeModule(dfw::FuzzerRunnerCLArgs args);
-  std::optional<std::vector<uint8_t>> DumpFunction(std::string const& name);
+  void TeardownModule();
+  bool RunIsolated(std::function<bool()> const& job);
+  std::optional<std::vector<uint8_t>> DumpFunction(dfw::FunctionHandle handle);
   bool MarshallMemoryImport(uint8_t* source, size_t len);
   bool InitializeExecution();
-  std::tuple<std::optional<dfw::JSValue>, uint64_t> InvokeFunction(std::string const& name, std::vector<dfw::JSValue> const& args);
-  std::vector<dfw::FunctionInfo> const& Functions() const { 
-    functions.clear();
-
-    // Fill reflection information
-    for(auto& func : this->compiled_wasm.Functions()) {
-      dfw::FunctionInfo info;
-      info.function_name = func.Name();
-      info.return_type = (dfw::WasmType)func.ReturnType();
-      info.instruction_address = func.InstructionAddress();
-      for(auto param : func.Parameters())
-        info.parameters.push_back((dfw::WasmType)param);
-      
-      functions.emplace_back(std::move(info));
-    }
-    return functions; 
-  }
+  std::tuple<std::optional<dfw::JSValue>, uint64_t> InvokeFunction(dfw::FunctionHandle handle, std::vector<dfw::JSValue> const& args);
+  void InvokeBatch(dfw::BatchCall const* calls, size_t count, uint64_t const* args, dfw::BatchResult* results,
+                   std::function<void(size_t)> const& after_call);
+  std::vector<dfw::FunctionInfo> const& Functions() const { return functions; }
   std::vector<dfw::GlobalInfo> const& Globals() const { return globals; }
   void SetGlobal(std::string const& arg, dfw::JSValue value);
   dfw::JSValue GetGlobal(std::string const& arg);
-  std::vector<dfw::MemoryDiff> CompareInternalMemory(std::vector<uint8_t>& buffer);
+  void ReadAllGlobals(std::span<dfw::JSValue> values);
+  void WriteAllGlobals(std::span<dfw::JSValue const> values);
+  std::vector<dfw::MemoryRange> CompareInternalMemory(std::span<uint8_t> buffer);
   ~RunnerV8();
 
   uintptr_t GetWasmMemoryAddress() {
     auto wasmMem = this->compiled_wasm.GetWasmMemory();
     return (uintptr_t)wasmMem.buffer.get();
   }
+
+  size_t GetWasmMemorySize() {
+    return this->compiled_wasm.GetWasmMemory().length;
+  }
 };
 
 
 bool RunnerV8::InitializeModule(dfw::FuzzerRunnerCLArgs args) {
   // Start Compiling
-  auto bsource = dfw::OpenInput(args.input);
+  auto bsource = dfw::MappedFile::Open(args.input);
+  if(!bsource.has_value())
+    return false;
   v8::Maybe<v8::ext::CompiledWasm> res = 
-      v8::ext::CompileBinaryWasm(isolate, bsource.data(), bsource.size());
+      v8::ext::CompileBinaryWasm(isolate, bsource->Data(), bsource->Size());
   
   // Store the compiled WASM locally
   if(!res.IsNothing()) {
     this->compiled_wasm = res.ToChecked();
 
-    
+    // Fill reflection information, the handles are indices into it
+    for(auto& func : this->compiled_wasm.Functions()) {
+      dfw::FunctionInfo info;
+      info.function_name = func.Name();
+      info.return_type = (dfw::WasmType)func.ReturnType();
+      info.instruction_address = func.InstructionAddress();
+      for(auto param : func.Parameters())
+        info.parameters.push_back((dfw::WasmType)param);
+      
+      this->functions.emplace_back(std::move(info));
+    }
 
     // New Global Import to populate the globals
     
@@ -90,13 +99,24 @@ bool RunnerV8::InitializeModule(dfw::FuzzerRunnerCLArgs args) {
   }
 }
 
-std::optional<std::vector<uint8_t>> RunnerV8::DumpFunction(std::string const& name) {
-  try {
-    auto& func = this->compiled_wasm.FunctionByName(name);
-    return std::make_optional(func.Instructions());
-  } catch(std::exception const& e) {
+void RunnerV8::TeardownModule() {
+  // Release the module, its instance and the imports
+  this->compiled_wasm = v8::ext::CompiledWasm {};
+  this->functions.clear();
+  this->globals.clear();
+}
+
+bool RunnerV8::RunIsolated(std::function<bool()> const& job) {
+  // Release the local handles created by the job once it finished
+  v8::HandleScope handle_scope(isolate);
+  return job();
+}
+
+std::optional<std::vector<uint8_t>> RunnerV8::DumpFunction(dfw::FunctionHandle handle) {
+  auto& wasm_functions = this->compiled_wasm.Functions();
+  if(handle >= wasm_functions.size())
     return std::nullopt;
-  }
+  return std::make_optional(wasm_functions[handle].Instructions());
 }
 
 bool RunnerV8::MarshallMemoryImport(uint8_t* source, size_t len) {
@@ -113,9 +133,7 @@ bool RunnerV8::MarshallMemoryImport(uint8_t* source, size_t len) {
   // and the remainder will be undefined
   // If source is bigger than WASM memory, only fill to the available WASM memory and the
   // remainder is discarded
-  auto buffer = wasmMem.buffer.get();
-  for(int i = 0; i < len && i < wasmMem.length; ++i)
-    buffer[i] = source[i];
+  std::memcpy(wasmMem.buffer.get(), source, std::min(len, wasmMem.length));
 
   return true;
 }
@@ -193,46 +211,57 @@ dfw::JSValue RunnerV8::GetGlobal(std::string const& arg) {
   return ret;
 }
 
+v8::Local<v8::Value> RunnerV8::MarshallArg(dfw::JSValue const& arg) {
+  switch(arg.type) {
+    case dfw::WasmType::I32: {
+      //std::cout << "i32: " << arg.i32 << " ";
+      //dfw::PrintHexRepresentation(arg.i32);
+      return v8::Int32::NewFromUnsigned(this->isolate, arg.i32);
+    }
+    case dfw::WasmType::I64: {
+      //std::cout << "i64: " << arg.i64 << " ";
+      //dfw::PrintHexRepresentation(arg.i64);
+      return v8::BigInt::NewFromUnsigned(this->isolate, arg.i64);
+    }
+    case dfw::WasmType::F32: {
+      double d = arg.f32; // Implicit conversion first
+      //std::cout << "f32: " << arg.f32 << " ";
+      //dfw::PrintHexRepresentation(d);
+      return v8::Number::New(this->isolate, d);
+    }
+    case dfw::WasmType::F64: {
+      //std::cout << "f64: " << arg.f64 << " ";
+      //dfw::PrintHexRepresentation(arg.f64);
+      return v8::Number::New(this->isolate, arg.f64);
+    }
+    default:
+      return v8::Local<v8::Value>();
+  }
+}
+
+// The ext API keys the global imports by name, the slots are in the order of globals
+void RunnerV8::ReadAllGlobals(std::span<dfw::JSValue> values) {
+  for(size_t g = 0; g < globals.size() && g < values.size(); ++g)
+    values[g] = GetGlobal(globals[g].global_name);
+}
+
+void RunnerV8::WriteAllGlobals(std::span<dfw::JSValue const> values) {
+  for(size_t g = 0; g < globals.size() && g < values.size(); ++g)
+    SetGlobal(globals[g].global_name, values[g]);
+}
+
 std::vector<v8::Local<v8::Value>> RunnerV8::MarshallArgs(std::vector<dfw::JSValue> const& args) {
   std::vector<v8::Local<v8::Value>> ret;
   for(auto& arg : args) {
-    switch(arg.type) {
-      case dfw::WasmType::I32: {
-        //std::cout << "i32: " << arg.i32 << " ";
-        //dfw::PrintHexRepresentation(arg.i32);
-        ret.emplace_back(v8::Int32::NewFromUnsigned(this->isolate, arg.i32));
-        break;
-      }
-      case dfw::WasmType::I64: {
-        //std::cout << "i64: " << arg.i64 << " ";
-        //dfw::PrintHexRepresentation(arg.i64);
-        ret.emplace_back(v8::BigInt::NewFromUnsigned(this->isolate, arg.i64));
-        break;
-      }
-      case dfw::WasmType::F32: {
-        double d = arg.f32; // Implicit conversion first
-        //std::cout << "f32: " << arg.f32 << " ";
-        //dfw::PrintHexRepresentation(d);
-        ret.emplace_back(v8::Number::New(this->isolate, d));
-        break;
-      }
-      case dfw::WasmType::F64: {
-        //std::cout << "f64: " << arg.f64 << " ";
-        //dfw::PrintHexRepresentation(arg.f64);
-        ret.emplace_back(v8::Number::New(this->isolate, arg.f64));
-        break;
-      }
-      default:
-        break;
-    }
-    //std::cout << std::endl;
+    if(arg.type != dfw::WasmType::Void)
+      ret.emplace_back(MarshallArg(arg));
   }
   //std::cout.flush();
   return ret;
 }
 
-std::tuple<std::optional<dfw::JSValue>, uint64_t> RunnerV8::InvokeFunction(std::string const& name, std::vector<dfw::JSValue> const& args) {
-  auto& funcMain = this->compiled_wasm.FunctionByName(name);
+std::tuple<std::optional<dfw::JSValue>, uint64_t> RunnerV8::InvokeFunction(dfw::FunctionHandle handle, std::vector<dfw::JSValue> const& args) {
+  auto& funcMain = this->compiled_wasm.Functions()[handle];
   
   // Marshall the argument
   std::vector<v8::Local<v8::Value>> args_marshalled = MarshallArgs(args);
@@ -246,20 +275,41 @@ std::tuple<std::optional<dfw::JSValue>, uint64_t> RunnerV8::InvokeFunction(std::
   }
 }
 
+void RunnerV8::InvokeBatch(dfw::BatchCall const* calls, size_t count, uint64_t const* args, dfw::BatchResult* results,
+                           std::function<void(size_t)> const& after_call) {
+  auto& wasm_functions = this->compiled_wasm.Functions();
+
+  // The argument vector keeps its capacity across the calls
+  std::vector<v8::Local<v8::Value>> args_marshalled;
+  for(size_t i = 0; i < count; ++i) {
+    {
+      // Release the handles of the call before the next one
+      v8::HandleScope handle_scope(isolate);
+      auto& params = functions[calls[i].function].parameters;
+      args_marshalled.clear();
+      for(size_t p = 0; p < params.size(); ++p)
+        args_marshalled.push_back(MarshallArg(dfw::UnpackArg(params[p], args[calls[i].first_arg + p])));
+
+      auto [ret, elapsed] = wasm_functions[calls[i].function].Invoke(isolate, args_marshalled);
+      auto& res = results[i];
+      res.elapsed = elapsed;
+      res.success = !ret.IsEmpty();
+      if(res.success)
+        res.result = MarshallValue(ret.ToLocalChecked());
+      else
+        res.result.type = dfw::WasmType::Void;
+    }
+    after_call(i);
+  }
+}
+
 RunnerV8::~RunnerV8() {
 
 }
 
-std::vector<dfw::MemoryDiff> RunnerV8::CompareInternalMemory(std::vector<uint8_t>& buffer) {
+std::vector<dfw::MemoryRange> RunnerV8::CompareInternalMemory(std::span<uint8_t> buffer) {
   auto ref = this->compiled_wasm.GetWasmMemory();
-  std::vector<dfw::MemoryDiff> ret;
-  for(uint32_t i = 0; i < std::min(ref.length, buffer.size()); ++i) {
-    if(buffer[i] != ref.buffer.get()[i]) {
-      ret.emplace_back(i, buffer[i], ref.buffer.get()[i]);
-      buffer[i] = ref.buffer.get()[i]; // Update the buffer
-    }
-  }
-  return ret;
+  return dfw::DiffMemory(buffer, (uint8_t const*)ref.buffer.get(), ref.length);
 }
 
 int main(int argc, char const* argv[]) {
@@ -268,7 +318,15 @@ int main(int argc, char const* argv[]) {
   // Initialize V8.
   v8::V8::InitializeICUDefaultLocation(argv[0]);
   v8::V8::InitializeExternalStartupData(argv[0]);
-  std::unique_ptr<v8::Platform> platform = v8::platform::NewDefaultPlatform();
+
+  // Worker threads do not survive fork(), keep V8 on the main thread
+  bool fork_safe = dfw::ForkSafeEngineRequired(argc, argv);
+  if(fork_safe)
+    v8::V8::SetFlagsFromString("--single-threaded");
+
+  std::unique_ptr<v8::Platform> platform = fork_safe 
+                                            ? v8::platform::NewSingleThreadedDefaultPlatform()
+                                            : v8::platform::NewDefaultPlatform();
   v8::V8::InitializePlatform(platform.get());
   v8::V8::Initialize();
 
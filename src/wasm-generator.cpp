@@ -12,9 +12,14 @@
 
 int main(int argc, char* argv[]) {
   if(argc < 4) {
-    std::cerr << "Need argument: [file output] [random size] [random seed]." << std::endl;
+    std::cerr << "Need argument: [file output] [random size] [random seed] [philox|mt19937]." << std::endl;
     return 1;
   }
+  auto generator = dfw::ParseRandomFill(argc > 4 ? argv[4] : "philox");
+  if(!generator.has_value()) {
+    std::cerr << "Unknown random generator, use philox or mt19937." << std::endl;
+    return 2;
+  }
   uint64_t randomSize = 0;
   uint64_t randomSeed = 0;
   {
@@ -56,7 +61,7 @@ int main(int argc, char* argv[]) {
 
     {
       std::cout << "Generating WASM...\n";
-      std::vector<uint8_t> randomizedData = dfw::GenerateRandomData(randomSeed, randomSize);
+      std::vector<uint8_t> randomizedData = dfw::GenerateRandomData(randomSeed, randomSize, *generator);
       std::vector<uint8_t> generatedWasm;
 
       v8::ext::GenerateRandomWasm(isolate, randomizedData, generatedWasm);